@@ -1,60 +1,233 @@
+#include <algorithm>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
-#include <map>
-#include <regex>
-#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
 
 using IntType = std::int64_t;
-using CycleLog = std::pair<IntType, IntType>;
+
+enum class OpCode : std::uint8_t { Noop, Addx };
+
+struct Instruction {
+    OpCode op;
+    std::int32_t arg;
+};
+
+// Decode a program source into a compact instruction array
+std::vector<Instruction> decode(std::string_view source)
+{
+    std::vector<Instruction> program;
+    while (!source.empty()) {
+        auto eol = source.find('\n');
+        auto line = source.substr(0, eol);
+        source.remove_prefix(eol == std::string_view::npos ? source.size() : eol + 1);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (line.empty())
+            continue;
+
+        if (line == "noop")
+            program.push_back({OpCode::Noop, 0});
+        else if (line.size() > 5 && line.substr(0, 5) == "addx ") {
+            std::int32_t sign = line[5] == '-' ? -1 : 1;
+            std::int32_t value = 0;
+            for (std::size_t pos = line[5] == '-' || line[5] == '+' ? 6 : 5; pos < line.size(); ++pos) {
+                if (line[pos] < '0' || line[pos] > '9')
+                    throw std::runtime_error("Invalid addx operand");
+                value = value * 10 + (line[pos] - '0');
+            }
+            program.push_back({OpCode::Addx, sign * value});
+        }
+        else
+            throw std::runtime_error("Unknown instruction");
+    }
+    return program;
+}
+
+// Runs a program once and keeps a table of the cycles at which the X register changes, so the value during any cycle
+// can be found with a binary search
+struct Cpu {
+    Cpu(const std::vector<Instruction> &program)
+    {
+        IntType cycle = 1;
+        IntType x = 1;
+        change_cycles.push_back(cycle);
+        x_values.push_back(x);
+        for (const auto &instruction : program) {
+            switch (instruction.op) {
+            case OpCode::Noop:
+                cycle += 1;
+                break;
+            case OpCode::Addx:
+                cycle += 2;
+                if (instruction.arg) {
+                    x += instruction.arg;
+                    change_cycles.push_back(cycle);
+                    x_values.push_back(x);
+                }
+                break;
+            }
+        }
+        cycle_count = cycle - 1;
+    }
+
+    // The value of X during the given cycle. Once the program has finished, X keeps its final value.
+    IntType x_during(IntType cycle) const
+    {
+        auto itr = std::upper_bound(change_cycles.cbegin(), change_cycles.cend(), cycle);
+        if (itr == change_cycles.cbegin())
+            return x_values.front();
+        return x_values[std::distance(change_cycles.cbegin(), itr) - 1];
+    }
+
+    IntType signal_strength(IntType cycle) const { return cycle * x_during(cycle); }
+    IntType get_cycle_count() const { return cycle_count; }
+
+    // Call fn(first_cycle, last_cycle, x) for each run of cycles during which X holds a single value
+    template <typename Fn>
+    void for_each_span(Fn &&fn) const
+    {
+        for (std::size_t idx = 0; idx < change_cycles.size(); ++idx) {
+            auto last_cycle = idx + 1 < change_cycles.size() ? change_cycles[idx + 1] - 1 : cycle_count;
+            last_cycle = std::min(last_cycle, cycle_count);
+            if (change_cycles[idx] <= last_cycle)
+                fn(change_cycles[idx], last_cycle, x_values[idx]);
+        }
+    }
+
+  protected:
+    std::vector<IntType> change_cycles;
+    std::vector<IntType> x_values;
+    IntType cycle_count = 0;
+};
+
+// One bit per pixel, with each row padded out to whole words
+struct Framebuffer {
+    Framebuffer(IntType width, IntType height)
+        : width(width), height(height), words_per_row((width + 63) / 64), bits(words_per_row * height, 0)
+    {
+    }
+
+    IntType get_width() const { return width; }
+    IntType get_height() const { return height; }
+
+    void clear() { std::fill(bits.begin(), bits.end(), 0); }
+
+    // Light the pixels [col_begin, col_end] of a row
+    void light(IntType row, IntType col_begin, IntType col_end)
+    {
+        auto *row_bits = bits.data() + row * words_per_row;
+        for (auto word = col_begin / 64; word <= col_end / 64; ++word) {
+            auto lo = std::max<IntType>(col_begin - word * 64, 0);
+            auto hi = std::min<IntType>(col_end - word * 64, 63);
+            row_bits[word] |= (~std::uint64_t(0) >> (63 - hi)) & (~std::uint64_t(0) << lo);
+        }
+    }
+
+    bool lit(IntType row, IntType col) const { return (bits[row * words_per_row + col / 64] >> (col % 64)) & 1; }
+
+    std::ostream &print(std::ostream &os) const
+    {
+        std::string line(width, ' ');
+        for (IntType row = 0; row < height; ++row) {
+            for (IntType col = 0; col < width; ++col)
+                line[col] = lit(row, col) ? '#' : ' ';
+            os << line << std::endl;
+        }
+        return os;
+    }
+
+  protected:
+    const IntType width;
+    const IntType height;
+    const IntType words_per_row;
+    std::vector<std::uint64_t> bits;
+};
+
+// Draw the CRT output of a program, printing each frame as soon as the beam leaves it. The three pixel wide sprite sits
+// still for each span of cycles between X changes, so each row of a span lights at most one short run of pixels.
+void render(const Cpu &cpu, Framebuffer &frame, std::ostream &os)
+{
+    const auto width = frame.get_width();
+    const auto frame_size = width * frame.get_height();
+    if (!frame_size)
+        return;
+
+    IntType frame_start = 1;
+    auto next_frame = [&]() {
+        frame.print(os);
+        os << std::endl;
+        frame.clear();
+        frame_start += frame_size;
+    };
+
+    cpu.for_each_span([&](IntType first_cycle, IntType last_cycle, IntType x) {
+        while (first_cycle <= last_cycle) {
+            if (first_cycle >= frame_start + frame_size)
+                next_frame();
+            auto frame_last = std::min(last_cycle, frame_start + frame_size - 1);
+            auto first_pixel = first_cycle - frame_start;
+            auto last_pixel = frame_last - frame_start;
+            for (auto row = first_pixel / width; row <= last_pixel / width; ++row) {
+                auto col_begin = std::max(row == first_pixel / width ? first_pixel % width : 0, x - 1);
+                auto col_end = std::min(row == last_pixel / width ? last_pixel % width : width - 1, x + 1);
+                if (col_begin <= col_end)
+                    frame.light(row, col_begin, col_end);
+            }
+            first_cycle = frame_last + 1;
+        }
+    });
+    frame.print(os);
+}
 
 int main(int argc, char *argv[])
 {
-    std::ifstream input_data(argv[1], std::ios::in);
+    std::ifstream input_data(argv[1], std::ios::in | std::ios::binary);
     if (!input_data)
         return EXIT_FAILURE;
 
-    std::regex noop_regex("noop");
-    std::regex addx_regex("addx ([0-9-]+)");
+    input_data.seekg(0, std::ios::end);
+    std::string source(static_cast<std::size_t>(input_data.tellg()), '\0');
+    input_data.seekg(0, std::ios::beg);
+    input_data.read(source.data(), static_cast<std::streamsize>(source.size()));
 
-    IntType sig_strength_acc = 0;
-    std::set<IntType> cycles_of_interest = {20, 60, 100, 140, 180, 220};
-    auto coi_itr = cycles_of_interest.cbegin();
-
-    IntType cycle_count = 1;
-    CycleLog prev_cycle = {0, 1};
-    CycleLog new_cycle;
-    std::string screen;
-
-    for (std::string cmd; std::getline(input_data, cmd); prev_cycle = new_cycle) {
-        std::smatch cmd_match;
-        if (std::regex_search(cmd, cmd_match, noop_regex))
-            new_cycle = CycleLog(prev_cycle.first + 1, prev_cycle.second);
-        else if (std::regex_search(cmd, cmd_match, addx_regex))
-            new_cycle = CycleLog(prev_cycle.first + 2, prev_cycle.second + std::atoll(cmd_match.str(1).c_str()));
-
-        // Part 1
-        if (prev_cycle.first < *coi_itr && new_cycle.first >= *coi_itr)
-            sig_strength_acc += *(coi_itr++) * prev_cycle.second;
-
-        // Part 2
-        while (cycle_count - 1 < new_cycle.first) {
-            auto sprite_min = prev_cycle.second;
-            auto sprite_max = prev_cycle.second + 2;
-            auto cursor_pos = ((cycle_count - 1) % 40) + 1;
-
-            if (cursor_pos >= sprite_min && cursor_pos <= sprite_max)
-                screen.push_back('#');
-            else
-                screen.push_back(' ');
-
-            cycle_count++;
+    Cpu cpu(decode(source));
+
+    // Further arguments are either '--crt=<width>x<height>' or cycles to query
+    IntType crt_width = 40;
+    IntType crt_height = 6;
+    std::vector<IntType> queries;
+    for (auto arg_idx = 2; arg_idx < argc; ++arg_idx) {
+        std::string_view arg(argv[arg_idx]);
+        if (arg.substr(0, 6) == "--crt=") {
+            crt_width = std::atoll(argv[arg_idx] + 6);
+            if (auto sep = arg.find('x'); sep != std::string_view::npos)
+                crt_height = std::atoll(argv[arg_idx] + sep + 1);
         }
+        else
+            queries.push_back(std::atoll(argv[arg_idx]));
     }
+    if (crt_width <= 0 || crt_height <= 0)
+        return EXIT_FAILURE;
+
+    // Part 1
+    IntType sig_strength_acc = 0;
+    for (IntType cycle : {20, 60, 100, 140, 180, 220})
+        sig_strength_acc += cpu.signal_strength(cycle);
 
     std::cout << "Signal Strength Accumulator: " << sig_strength_acc << std::endl;
+
+    // Part 2
     std::cout << "Screen:" << std::endl;
-    for (auto line = 0; line < 6; ++line)
-        std::cout << screen.substr(line * 40, 40) << std::endl;
+    Framebuffer frame(crt_width, crt_height);
+    render(cpu, frame, std::cout);
+
+    for (auto cycle : queries) {
+        std::cout << "Cycle " << cycle << ": X = " << cpu.x_during(cycle)
+                  << ", Signal Strength = " << cpu.signal_strength(cycle) << std::endl;
+    }
 
     return EXIT_SUCCESS;
 }
@@ -1,14 +1,18 @@
+#include <algorithm>
+#include <chrono>
 #include <fstream>
-#include <functional>
 #include <iostream>
-#include <list>
-#include <map>
+#include <limits>
+#include <numeric>
 #include <optional>
+#include <random>
 #include <regex>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 using IntType = std::int64_t;
-static constexpr IntType PART = 2;
 
 std::vector<std::string> tokenize(const std::string &str, char delim)
 {
@@ -27,21 +31,526 @@ std::vector<std::string> tokenize(const std::string &str, char delim)
     return tokens;
 }
 
+enum class OpKind { Add, Multiply, Double, Square };
+
+// A monkey's operation, compiled once from its "new = old <op> <val>" line
+struct Operation {
+    OpKind kind;
+    IntType operand = 0;
+
+    static Operation compile(char op_char, const std::string &op_val)
+    {
+        switch (op_char) {
+        case '*':
+            if (op_val == "old")
+                return {OpKind::Square};
+            return {OpKind::Multiply, std::atoll(op_val.c_str())};
+        case '+':
+            if (op_val == "old")
+                return {OpKind::Double};
+            return {OpKind::Add, std::atoll(op_val.c_str())};
+        default:
+            throw std::runtime_error("Unknown operation");
+        }
+    }
+};
+
+template <OpKind Kind, typename T>
+T apply(T old, T operand)
+{
+    if constexpr (Kind == OpKind::Add)
+        return old + operand;
+    else if constexpr (Kind == OpKind::Multiply)
+        return old * operand;
+    else if constexpr (Kind == OpKind::Double)
+        return old + old;
+    else
+        return old * old;
+}
+
+template <typename T>
+T apply(OpKind kind, T old, T operand)
+{
+    switch (kind) {
+    case OpKind::Add:
+        return apply<OpKind::Add>(old, operand);
+    case OpKind::Multiply:
+        return apply<OpKind::Multiply>(old, operand);
+    case OpKind::Double:
+        return apply<OpKind::Double>(old, operand);
+    case OpKind::Square:
+        return apply<OpKind::Square>(old, operand);
+    }
+    return old;
+}
+
+// Remainders modulo a fixed value by Barrett reduction: a high multiply and at most one correction instead of a
+// hardware divide. The reciprocal is floor((2^64 - 1) / m), which keeps the quotient estimate within one of the true
+// quotient for any 64-bit input. 128-bit inputs use floor((2^128 - 1) / m) the same way, and need the quotient to fit
+// in 64 bits, i.e. x < m * 2^64, which holds for any product of two reduced values.
+struct Reducer {
+    explicit Reducer(std::uint64_t modulus)
+        : modulus(modulus), reciprocal(~std::uint64_t(0) / modulus),
+          wide_reciprocal(~static_cast<unsigned __int128>(0) / modulus)
+    {
+    }
+
+    std::uint64_t reduce(std::uint64_t x) const
+    {
+        auto quotient = static_cast<std::uint64_t>((static_cast<unsigned __int128>(x) * reciprocal) >> 64);
+        auto remainder = x - quotient * modulus;
+        return remainder >= modulus ? remainder - modulus : remainder;
+    }
+
+    std::uint64_t reduce(unsigned __int128 x) const
+    {
+        // High 128 bits of the 256-bit product x * wide_reciprocal, built from four 64x64 multiplies
+        using Wide = unsigned __int128;
+        const auto x_lo = static_cast<std::uint64_t>(x);
+        const auto x_hi = static_cast<std::uint64_t>(x >> 64);
+        const auto r_lo = static_cast<std::uint64_t>(wide_reciprocal);
+        const auto r_hi = static_cast<std::uint64_t>(wide_reciprocal >> 64);
+        const auto lo_lo = Wide(x_lo) * r_lo;
+        const auto lo_hi = Wide(x_lo) * r_hi;
+        const auto hi_lo = Wide(x_hi) * r_lo;
+        const auto middle = (lo_lo >> 64) + static_cast<std::uint64_t>(lo_hi) + static_cast<std::uint64_t>(hi_lo);
+        const auto quotient = static_cast<std::uint64_t>(Wide(x_hi) * r_hi + (lo_hi >> 64) + (hi_lo >> 64) +
+                                                         (middle >> 64));
+
+        // The remainder is below 2m, so the low 64 bits of x - quotient * m are enough
+        auto remainder = x_lo - quotient * modulus;
+        return remainder >= modulus ? remainder - modulus : remainder;
+    }
+
+    bool divides(std::uint64_t x) const { return reduce(x) == 0; }
+    std::uint64_t get_modulus() const { return modulus; }
+
+  protected:
+    std::uint64_t modulus;
+    std::uint64_t reciprocal;
+    unsigned __int128 wide_reciprocal;
+};
+
+// How worry is kept in check after each inspection. Part 1 divides it by 3. Part 2 keeps it modulo the worry modulus,
+// multiplying in 64 bits while the modulus fits in 32 bits and in 128 bits beyond that.
+enum class WorryMode { Relief, Narrow, Wide };
+
+template <OpKind Kind, WorryMode Mode>
+IntType next_worry(IntType old, IntType operand, const Reducer &modulus)
+{
+    if constexpr (Mode == WorryMode::Relief)
+        return apply<Kind>(old, operand) / 3;
+    else if constexpr (Mode == WorryMode::Narrow)
+        return modulus.reduce(apply<Kind>(std::uint64_t(old), std::uint64_t(operand)));
+    else
+        return modulus.reduce(
+            apply<Kind>(static_cast<unsigned __int128>(old), static_cast<unsigned __int128>(operand)));
+}
+
+// FIFO of worry levels backed by a power-of-two ring, so a monkey's queue is reused round after round without
+// allocating
+struct ItemQueue {
+    void push_back(IntType item)
+    {
+        if (count == slots.size())
+            grow();
+        slots[(head + count) & (slots.size() - 1)] = item;
+        ++count;
+    }
+
+    IntType pop_front()
+    {
+        auto item = slots[head];
+        head = (head + 1) & (slots.size() - 1);
+        --count;
+        return item;
+    }
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    IntType operator[](std::size_t idx) const { return slots[(head + idx) & (slots.size() - 1)]; }
+
+  protected:
+    void grow()
+    {
+        std::vector<IntType> new_slots(std::max<std::size_t>(8, slots.size() * 2));
+        for (std::size_t idx = 0; idx < count; ++idx)
+            new_slots[idx] = (*this)[idx];
+        slots = std::move(new_slots);
+        head = 0;
+    }
+
+    std::vector<IntType> slots;
+    std::size_t head = 0;
+    std::size_t count = 0;
+};
+
 struct Monkey {
-    std::list<IntType> items;
-    std::function<IntType(IntType)> operation;
-    std::function<IntType(IntType)> get_outbound_direction;
-    std::function<IntType(IntType)> normalize_input;
+    ItemQueue items;
+    Operation operation;
+    IntType test_divisor = 1;
+    IntType test_true = 0;
+    IntType test_false = 0;
     IntType total_inspections = 0;
+
+    IntType get_outbound_direction(IntType x) const { return (x % test_divisor) ? test_false : test_true; }
 };
 
-int main(int argc, char *argv[])
+// Worry levels can be kept modulo any common multiple of the test divisors without changing a single throw. The least
+// one is used, and it must fit in a worry level.
+IntType get_normalizer(const std::vector<Monkey> &monkeys)
 {
-    std::ifstream input_data(argv[1], std::ios::in);
-    if (!input_data)
-        return EXIT_FAILURE;
+    IntType normalizer = 1;
+    for (const auto &monkey : monkeys) {
+        if (monkey.test_divisor <= 0)
+            throw std::runtime_error("Invalid test divisor");
+        auto next = static_cast<unsigned __int128>(normalizer / std::gcd(normalizer, monkey.test_divisor)) *
+                    static_cast<unsigned __int128>(monkey.test_divisor);
+        if (next > static_cast<unsigned __int128>(std::numeric_limits<IntType>::max()))
+            throw std::runtime_error("Worry modulus does not fit in 63 bits");
+        normalizer = static_cast<IntType>(next);
+    }
+    return normalizer;
+}
+
+WorryMode get_worry_mode(bool relief, IntType normalizer)
+{
+    if (relief)
+        return WorryMode::Relief;
+    return normalizer < (IntType(1) << 32) ? WorryMode::Narrow : WorryMode::Wide;
+}
+
+// Inspect and throw every item a monkey holds. This is instantiated per operation kind and part, so the loop has no
+// indirect calls.
+template <OpKind Kind, bool Relief>
+void take_turn(Monkey &monkey, std::vector<Monkey> &monkeys, IntType normalizer)
+{
+    for (auto remaining = monkey.items.size(); remaining--;) {
+        auto item = monkey.items.pop_front();
+        monkey.total_inspections++;
+        if constexpr (Relief)
+            item = apply<Kind>(item, monkey.operation.operand) / 3;
+        else
+            item = static_cast<IntType>(apply<Kind>(static_cast<unsigned __int128>(item),
+                                                    static_cast<unsigned __int128>(monkey.operation.operand)) %
+                                        normalizer);
+        monkeys[monkey.get_outbound_direction(item)].items.push_back(item);
+    }
+}
+
+template <bool Relief>
+void take_turn(Monkey &monkey, std::vector<Monkey> &monkeys, IntType normalizer)
+{
+    switch (monkey.operation.kind) {
+    case OpKind::Add:
+        take_turn<OpKind::Add, Relief>(monkey, monkeys, normalizer);
+        break;
+    case OpKind::Multiply:
+        take_turn<OpKind::Multiply, Relief>(monkey, monkeys, normalizer);
+        break;
+    case OpKind::Double:
+        take_turn<OpKind::Double, Relief>(monkey, monkeys, normalizer);
+        break;
+    case OpKind::Square:
+        take_turn<OpKind::Square, Relief>(monkey, monkeys, normalizer);
+        break;
+    }
+}
+
+// Run the rounds on a copy of the monkeys and return each monkey's inspection total. Part 1 divides worry by 3 after
+// each inspection, while Part 2 keeps it modulo the least common multiple of the test divisors. This is the plain
+// item at a time reference for the engines below.
+std::vector<IntType> simulate(std::vector<Monkey> monkeys, IntType rounds, bool relief)
+{
+    const auto normalizer = get_normalizer(monkeys);
+    while (rounds--) {
+        for (auto &monkey : monkeys) {
+            if (relief)
+                take_turn<true>(monkey, monkeys, normalizer);
+            else
+                take_turn<false>(monkey, monkeys, normalizer);
+        }
+    }
 
-    // Build the monkeys
+    std::vector<IntType> inspections;
+    for (const auto &monkey : monkeys)
+        inspections.push_back(monkey.total_inspections);
+    return inspections;
+}
+
+// Runs rounds a whole monkey at a time. Each turn transforms the monkey's batch of worries in one tight loop, then
+// routes it with a counting pass and a scatter pass into its two destination batches. The batches keep their capacity
+// between rounds, so after the first few rounds nothing is allocated.
+struct BatchEngine {
+    BatchEngine(const std::vector<Monkey> &monkey_list, bool relief)
+        : monkeys(monkey_list), modulus(get_normalizer(monkey_list)),
+          mode(get_worry_mode(relief, modulus.get_modulus())), batches(monkey_list.size()),
+          inspections(monkey_list.size(), 0)
+    {
+        // Outside of Part 1, initial worries and operands can be reduced up front so every product stays in range
+        for (std::size_t index = 0; index < monkeys.size(); ++index) {
+            const auto &monkey = monkeys[index];
+            divisors.emplace_back(monkey.test_divisor);
+            operands.push_back(mode == WorryMode::Relief ? monkey.operation.operand
+                                                          : modulus.reduce(std::uint64_t(monkey.operation.operand)));
+            for (std::size_t item_idx = 0; item_idx < monkey.items.size(); ++item_idx) {
+                auto item = monkey.items[item_idx];
+                batches[index].push_back(mode == WorryMode::Relief ? item : modulus.reduce(std::uint64_t(item)));
+            }
+        }
+    }
+
+    void run(IntType rounds)
+    {
+        while (rounds--) {
+            for (std::size_t index = 0; index < monkeys.size(); ++index) {
+                switch (mode) {
+                case WorryMode::Relief:
+                    take_turn<WorryMode::Relief>(index);
+                    break;
+                case WorryMode::Narrow:
+                    take_turn<WorryMode::Narrow>(index);
+                    break;
+                case WorryMode::Wide:
+                    take_turn<WorryMode::Wide>(index);
+                    break;
+                }
+            }
+        }
+    }
+
+    const std::vector<IntType> &get_inspections() const { return inspections; }
+
+  protected:
+    template <OpKind Kind, WorryMode Mode>
+    void transform(IntType *items, std::size_t count, IntType operand) const
+    {
+        for (std::size_t idx = 0; idx < count; ++idx)
+            items[idx] = next_worry<Kind, Mode>(items[idx], operand, modulus);
+    }
+
+    template <WorryMode Mode>
+    void take_turn(std::size_t index)
+    {
+        // Take the monkey's items out of its batch first, so items it throws to itself wait for its next turn
+        auto &batch = turn;
+        batch.swap(batches[index]);
+        const auto &monkey = monkeys[index];
+        const auto count = batch.size();
+        if (!count)
+            return;
+        inspections[index] += count;
+
+        switch (monkey.operation.kind) {
+        case OpKind::Add:
+            transform<OpKind::Add, Mode>(batch.data(), count, operands[index]);
+            break;
+        case OpKind::Multiply:
+            transform<OpKind::Multiply, Mode>(batch.data(), count, operands[index]);
+            break;
+        case OpKind::Double:
+            transform<OpKind::Double, Mode>(batch.data(), count, operands[index]);
+            break;
+        case OpKind::Square:
+            transform<OpKind::Square, Mode>(batch.data(), count, operands[index]);
+            break;
+        }
+
+        if (monkey.test_true == monkey.test_false) {
+            auto &dst = batches[monkey.test_true];
+            dst.insert(dst.end(), batch.cbegin(), batch.cend());
+            batch.clear();
+            return;
+        }
+
+        // Count each destination's share first, so both can be grown once and filled without further checks
+        const auto &divisor = divisors[index];
+        routes.resize(count);
+        std::size_t true_count = 0;
+        for (std::size_t idx = 0; idx < count; ++idx) {
+            routes[idx] = divisor.divides(batch[idx]);
+            true_count += routes[idx];
+        }
+
+        auto &true_batch = batches[monkey.test_true];
+        auto &false_batch = batches[monkey.test_false];
+        auto true_pos = true_batch.size();
+        auto false_pos = false_batch.size();
+        true_batch.resize(true_pos + true_count);
+        false_batch.resize(false_pos + count - true_count);
+        for (std::size_t idx = 0; idx < count; ++idx) {
+            if (routes[idx])
+                true_batch[true_pos++] = batch[idx];
+            else
+                false_batch[false_pos++] = batch[idx];
+        }
+        batch.clear();
+    }
+
+    const std::vector<Monkey> &monkeys;
+    const Reducer modulus;
+    const WorryMode mode;
+    std::vector<Reducer> divisors;
+    std::vector<IntType> operands;
+    std::vector<std::vector<IntType>> batches;
+    std::vector<IntType> turn;
+    std::vector<IntType> inspections;
+    std::vector<std::uint8_t> routes;
+};
+
+// With worry levels kept modulo a common multiple of the test divisors, each item moves through the monkeys
+// independently of the others, and its (monkey, worry) state at the start of each round is eventually periodic. Each
+// item is run on its own, Brent's algorithm finds its cycle, and its inspection counts are extrapolated to any number
+// of rounds.
+struct CycleEngine {
+    struct State {
+        IntType monkey;
+        IntType worry;
+        bool operator==(const State &rhs) const { return monkey == rhs.monkey && worry == rhs.worry; }
+        bool operator!=(const State &rhs) const { return !(*this == rhs); }
+    };
+
+    CycleEngine(const std::vector<Monkey> &monkey_list) : modulus(get_normalizer(monkey_list))
+    {
+        for (const auto &monkey : monkey_list) {
+            monkeys.push_back(&monkey);
+            divisors.emplace_back(monkey.test_divisor);
+            operands.push_back(modulus.reduce(std::uint64_t(monkey.operation.operand)));
+        }
+    }
+
+    // Per monkey inspection totals after the given number of rounds
+    std::vector<IntType> inspections(IntType rounds, IntType thread_count) const
+    {
+        std::vector<State> items;
+        for (IntType index = 0; index < static_cast<IntType>(monkeys.size()); ++index) {
+            const auto &queue = monkeys[index]->items;
+            for (std::size_t item_idx = 0; item_idx < queue.size(); ++item_idx)
+                items.push_back({index, static_cast<IntType>(modulus.reduce(std::uint64_t(queue[item_idx])))});
+        }
+
+        thread_count = std::max<IntType>(1, std::min<IntType>(thread_count, items.size()));
+        std::vector<std::vector<IntType>> partials(thread_count, std::vector<IntType>(monkeys.size(), 0));
+        std::vector<std::thread> workers;
+        for (IntType thread_idx = 0; thread_idx < thread_count; ++thread_idx) {
+            workers.emplace_back([&, thread_idx]() {
+                const auto item_count = static_cast<IntType>(items.size());
+                for (auto item_idx = thread_idx; item_idx < item_count; item_idx += thread_count)
+                    item_inspections(items[item_idx], rounds, partials[thread_idx]);
+            });
+        }
+        for (auto &worker : workers)
+            worker.join();
+
+        std::vector<IntType> totals(monkeys.size(), 0);
+        for (const auto &partial : partials) {
+            for (std::size_t index = 0; index < totals.size(); ++index)
+                totals[index] += partial[index];
+        }
+        return totals;
+    }
+
+  protected:
+    // Advance an item through one round. Items thrown to a later monkey are inspected again in the same round.
+    State next_round(State state, IntType *counts = nullptr) const
+    {
+        for (;;) {
+            const auto &monkey = *monkeys[state.monkey];
+            if (counts)
+                counts[state.monkey]++;
+            state.worry = modulus.reduce(apply(monkey.operation.kind, static_cast<unsigned __int128>(state.worry),
+                                               static_cast<unsigned __int128>(operands[state.monkey])));
+            auto target = divisors[state.monkey].divides(state.worry) ? monkey.test_true : monkey.test_false;
+            if (target <= state.monkey)
+                return {target, state.worry};
+            state.monkey = target;
+        }
+    }
+
+    State run(State state, IntType rounds, IntType *counts) const
+    {
+        while (rounds--)
+            state = next_round(state, counts);
+        return state;
+    }
+
+    void item_inspections(State start, IntType rounds, std::vector<IntType> &totals) const
+    {
+        std::vector<IntType> counts(monkeys.size(), 0);
+
+        // Brent's algorithm, giving up once it has cost as much as just running the rounds
+        IntType power = 1;
+        IntType period = 1;
+        IntType budget = rounds;
+        auto tortoise = start;
+        auto hare = next_round(start);
+        while (tortoise != hare && budget-- > 0) {
+            if (power == period) {
+                tortoise = hare;
+                power *= 2;
+                period = 0;
+            }
+            hare = next_round(hare);
+            ++period;
+        }
+
+        if (tortoise != hare) {
+            run(start, rounds, counts.data());
+        }
+        else {
+            IntType prefix = 0;
+            tortoise = start;
+            hare = run(start, period, nullptr);
+            for (; tortoise != hare && prefix < rounds; ++prefix) {
+                tortoise = next_round(tortoise, counts.data());
+                hare = next_round(hare);
+            }
+
+            // Rounds left after the prefix are whole trips around the cycle plus a partial one
+            if (rounds > prefix) {
+                auto laps = (rounds - prefix) / period;
+                auto remainder = (rounds - prefix) % period;
+                std::vector<IntType> lap_counts(monkeys.size(), 0);
+                auto state = run(tortoise, remainder, lap_counts.data());
+                for (std::size_t index = 0; index < counts.size(); ++index)
+                    counts[index] += lap_counts[index];
+                run(state, period - remainder, lap_counts.data());
+                for (std::size_t index = 0; index < counts.size(); ++index)
+                    counts[index] += laps * lap_counts[index];
+            }
+        }
+
+        for (std::size_t index = 0; index < totals.size(); ++index)
+            totals[index] += counts[index];
+    }
+
+    std::vector<const Monkey *> monkeys;
+    Reducer modulus;
+    std::vector<Reducer> divisors;
+    std::vector<IntType> operands;
+};
+
+std::string to_string(unsigned __int128 value)
+{
+    std::string digits;
+    do {
+        digits.push_back(static_cast<char>('0' + value % 10));
+        value /= 10;
+    } while (value);
+    return {digits.rbegin(), digits.rend()};
+}
+
+// The product of the two largest inspection totals
+unsigned __int128 monkey_business(std::vector<IntType> inspections)
+{
+    if (inspections.size() < 2)
+        return 0;
+    std::nth_element(inspections.begin(), inspections.begin() + 1, inspections.end(), std::greater<>());
+    return (unsigned __int128)inspections[0] * inspections[1];
+}
+
+std::vector<Monkey> parse_monkeys(std::istream &input_data)
+{
     std::regex monkey_regex("Monkey ([0-9]+)");
     std::regex item_regex("Starting items: ([0-9, ]+)");
     std::regex operation_regex("Operation: new = old ([\\+\\*]) ([a-z0-9]+)");
@@ -49,130 +558,181 @@ int main(int argc, char *argv[])
     std::regex test_true_regex("If true: throw to monkey ([0-9]+)");
     std::regex test_false_regex("If false: throw to monkey ([0-9]+)");
 
-    std::map<IntType, Monkey> monkeys;
-    {
-        std::optional<IntType> index;
-        std::list<IntType> items;
-        std::optional<char> op_char;
-        std::optional<std::string> op_val;
-        std::optional<IntType> test_divisor;
-        std::optional<IntType> test_true;
-        std::optional<IntType> test_false;
-        IntType normalizer = 1;
-
-        for (std::string line; std::getline(input_data, line);) {
-            if (line.empty())
-                continue;
-
-            std::smatch match;
-            if (std::regex_search(line, match, monkey_regex))
-                index = std::atoll(match.str(1).c_str());
-            else if (std::regex_search(line, match, item_regex)) {
-                auto tokens = tokenize(match.str(1), ',');
-                for (auto token : tokens)
-                    items.push_back(std::atoll(token.c_str()));
-            }
-            else if (std::regex_search(line, match, operation_regex)) {
-                op_char = match.str(1)[0];
-                op_val = match.str(2);
-            }
-            else if (std::regex_search(line, match, test_regex))
-                test_divisor = std::atoll(match.str(1).c_str());
-            else if (std::regex_search(line, match, test_true_regex))
-                test_true = std::atoll(match.str(1).c_str());
-            else if (std::regex_search(line, match, test_false_regex))
-                test_false = std::atoll(match.str(1).c_str());
-
-            // If we have the parameters, create the monkey
-            if (index && items.size() && op_char && op_val && test_divisor && test_true && test_false) {
-                auto &monkey = monkeys[*index];
-                monkey.items = items;
-                monkey.get_outbound_direction = [test_divisor, test_true, test_false](IntType x) {
-                    return (x % *test_divisor) ? *test_false : *test_true;
-                };
-
-                if constexpr (PART == 1) {
-                    monkey.normalize_input = [](IntType x) { return x; };
-                    switch (*op_char) {
-                    case '*':
-                        if (*op_val == "old")
-                            monkey.operation = [](IntType x) { return (x * x) / 3; };
-                        else
-                            monkey.operation = [op_val](IntType x) { return (x * std::atoll(op_val->c_str())) / 3; };
-                        break;
-                    case '+':
-                        if (*op_val == "old")
-                            monkey.operation = [](IntType x) { return (x + x) / 3; };
-                        else
-                            monkey.operation = [op_val](IntType x) { return (x + std::atoll(op_val->c_str())) / 3; };
-                        break;
-                    default:
-                        break;
-                    }
-                }
-                else {
-                    normalizer *= *test_divisor;
-                    switch (*op_char) {
-                    case '*':
-                        if (*op_val == "old")
-                            monkey.operation = [](IntType x) { return (x * x); };
-                        else
-                            monkey.operation = [op_val](IntType x) { return x * std::atoll(op_val->c_str()); };
-                        break;
-                    case '+':
-                        if (*op_val == "old")
-                            monkey.operation = [](IntType x) { return (x + x); };
-                        else
-                            monkey.operation = [op_val](IntType x) { return x + std::atoll(op_val->c_str()); };
-                        break;
-                    default:
-                        break;
-                    }
-                }
+    std::vector<Monkey> monkeys;
+    std::optional<IntType> index;
+    std::vector<IntType> items;
+    std::optional<char> op_char;
+    std::optional<std::string> op_val;
+    std::optional<IntType> test_divisor;
+    std::optional<IntType> test_true;
+    std::optional<IntType> test_false;
 
-                index.reset();
-                items.clear();
-                op_char.reset();
-                op_val.reset();
-                test_divisor.reset();
-                test_true.reset();
-                test_false.reset();
-            }
+    for (std::string line; std::getline(input_data, line);) {
+        if (line.empty())
+            continue;
+
+        std::smatch match;
+        if (std::regex_search(line, match, monkey_regex))
+            index = std::atoll(match.str(1).c_str());
+        else if (std::regex_search(line, match, item_regex)) {
+            auto tokens = tokenize(match.str(1), ',');
+            for (auto token : tokens)
+                items.push_back(std::atoll(token.c_str()));
+        }
+        else if (std::regex_search(line, match, operation_regex)) {
+            op_char = match.str(1)[0];
+            op_val = match.str(2);
         }
+        else if (std::regex_search(line, match, test_regex))
+            test_divisor = std::atoll(match.str(1).c_str());
+        else if (std::regex_search(line, match, test_true_regex))
+            test_true = std::atoll(match.str(1).c_str());
+        else if (std::regex_search(line, match, test_false_regex))
+            test_false = std::atoll(match.str(1).c_str());
 
-        for (auto &monkey_pair : monkeys) {
-            if constexpr (PART == 1)
-                monkey_pair.second.normalize_input = [normalizer](IntType x) { return x; };
-            else
-                monkey_pair.second.normalize_input = [normalizer](IntType x) { return x % normalizer; };
+        // If we have the parameters, create the monkey
+        if (index && items.size() && op_char && op_val && test_divisor && test_true && test_false) {
+            if (*index >= static_cast<IntType>(monkeys.size()))
+                monkeys.resize(*index + 1);
+            auto &monkey = monkeys[*index];
+            for (auto item : items)
+                monkey.items.push_back(item);
+            monkey.operation = Operation::compile(*op_char, *op_val);
+            monkey.test_divisor = *test_divisor;
+            monkey.test_true = *test_true;
+            monkey.test_false = *test_false;
+
+            index.reset();
+            items.clear();
+            op_char.reset();
+            op_val.reset();
+            test_divisor.reset();
+            test_true.reset();
+            test_false.reset();
         }
     }
 
-    // Run the monkey rounds, then sort them
-    IntType rounds = PART == 1 ? 20 : 10000;
-    while (rounds--) {
-        for (auto &monkey_pair : monkeys) {
-            auto &monkey = monkey_pair.second;
-            for (auto &item : monkey.items) {
-                monkey.total_inspections++;
-                item = monkey.operation(item);
-
-                auto &inbound_monkey = monkeys[monkey.get_outbound_direction(item)];
-                inbound_monkey.items.push_back(inbound_monkey.normalize_input(item));
+    for (const auto &monkey : monkeys) {
+        if (monkey.test_true >= static_cast<IntType>(monkeys.size()) ||
+            monkey.test_false >= static_cast<IntType>(monkeys.size()))
+            throw std::runtime_error("Monkey throws to an unknown monkey");
+    }
+    return monkeys;
+}
+
+// Generate a random monkey configuration. Divisors are drawn from the first few primes so the worry modulus stays
+// small.
+std::vector<Monkey> generate_monkeys(IntType monkey_count, IntType item_count, std::mt19937_64 &rng)
+{
+    static constexpr IntType PRIMES[] = {2, 3, 5, 7, 11, 13, 17, 19, 23};
+    std::uniform_int_distribution<IntType> prime_dist(0, std::size(PRIMES) - 1);
+    std::uniform_int_distribution<IntType> kind_dist(0, 3);
+    std::uniform_int_distribution<IntType> operand_dist(1, 19);
+    std::uniform_int_distribution<IntType> target_dist(0, monkey_count - 2);
+    std::uniform_int_distribution<IntType> worry_dist(1, 100);
+
+    std::vector<Monkey> monkeys(monkey_count);
+    for (IntType index = 0; index < monkey_count; ++index) {
+        auto &monkey = monkeys[index];
+        monkey.operation = {static_cast<OpKind>(kind_dist(rng)), operand_dist(rng)};
+        monkey.test_divisor = PRIMES[prime_dist(rng)];
+        auto other_monkey = [&]() {
+            auto target = target_dist(rng);
+            return target >= index ? target + 1 : target;
+        };
+        monkey.test_true = other_monkey();
+        monkey.test_false = other_monkey();
+    }
+    std::uniform_int_distribution<IntType> owner_dist(0, monkey_count - 1);
+    for (IntType item = 0; item < item_count; ++item)
+        monkeys[owner_dist(rng)].items.push_back(worry_dist(rng));
+    return monkeys;
+}
+
+// Compare the item-at-a-time rounds against the batched engine on a generated configuration
+void benchmark(IntType monkey_count, IntType item_count, IntType rounds)
+{
+    std::mt19937_64 rng(11);
+    auto monkeys = generate_monkeys(std::max<IntType>(2, monkey_count), item_count, rng);
+    auto elapsed_s = [](auto start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+    auto report = [&](const char *name, const std::vector<IntType> &inspections, double seconds) {
+        auto total = std::accumulate(inspections.cbegin(), inspections.cend(), IntType(0));
+        std::cout << name << ": " << seconds * 1000 << " ms, " << total / seconds / 1e6
+                  << " M items/s (monkey business " << to_string(monkey_business(inspections)) << ")" << std::endl;
+    };
+
+    std::cout << "Monkeys: " << monkeys.size() << ", Items: " << item_count << ", Rounds: " << rounds << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    auto reference = simulate(monkeys, rounds, false);
+    report("Item at a time", reference, elapsed_s(start));
+
+    start = std::chrono::steady_clock::now();
+    BatchEngine engine(monkeys, false);
+    engine.run(rounds);
+    report("Batched", engine.get_inspections(), elapsed_s(start));
+    if (engine.get_inspections() != reference)
+        std::cout << "Batched inspection counts differ from the item at a time rounds!" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+        return EXIT_FAILURE;
+    if (std::string_view(argv[1]) == "--bench") {
+        benchmark(argc > 2 ? std::atoll(argv[2]) : 1000, argc > 3 ? std::atoll(argv[3]) : 1000000,
+                  argc > 4 ? std::atoll(argv[4]) : 20);
+        return EXIT_SUCCESS;
+    }
+
+    std::ifstream input_data(argv[1], std::ios::in);
+    if (!input_data)
+        return EXIT_FAILURE;
+
+    // Both parts run from one parse. '--part=1' or '--part=2' picks one, and '--rounds=<n>' runs Part 2 for any number
+    // of rounds through the cycle engine.
+    bool run_part1 = true;
+    bool run_part2 = true;
+    std::optional<IntType> part2_rounds;
+    for (auto arg_idx = 2; arg_idx < argc; ++arg_idx) {
+        std::string_view arg(argv[arg_idx]);
+        if (arg == "--part=1")
+            run_part2 = false;
+        else if (arg == "--part=2")
+            run_part1 = false;
+        else if (arg.substr(0, 9) == "--rounds=") {
+            part2_rounds = std::atoll(argv[arg_idx] + 9);
+            if (*part2_rounds < 0) {
+                std::cerr << "Round count must not be negative" << std::endl;
+                return EXIT_FAILURE;
             }
-            monkey.items.clear();
+            run_part1 = false;
         }
     }
 
-    // Sort the monkeys to find the monkey business
-    std::vector<std::pair<IntType, Monkey>> sorted_monkeys;
-    for (auto &monkey_pair : monkeys)
-        sorted_monkeys.emplace_back(monkey_pair.first, monkey_pair.second);
-    std::sort(sorted_monkeys.begin(), sorted_monkeys.end(),
-              [](const auto &a, const auto &b) { return a.second.total_inspections > b.second.total_inspections; });
+    const auto monkeys = parse_monkeys(input_data);
 
-    std::cout << "Monkey Business: "
-              << sorted_monkeys[0].second.total_inspections * sorted_monkeys[1].second.total_inspections << std::endl;
+    if (run_part1) {
+        BatchEngine engine(monkeys, true);
+        engine.run(20);
+        std::cout << "Monkey Business (Part 1): " << to_string(monkey_business(engine.get_inspections()))
+                  << std::endl;
+    }
+
+    if (run_part2) {
+        std::vector<IntType> inspections;
+        if (part2_rounds) {
+            auto thread_count = std::max(1u, std::thread::hardware_concurrency());
+            inspections = CycleEngine(monkeys).inspections(*part2_rounds, thread_count);
+        }
+        else {
+            BatchEngine engine(monkeys, false);
+            engine.run(10000);
+            inspections = engine.get_inspections();
+        }
+        std::cout << "Monkey Business (Part 2): " << to_string(monkey_business(inspections)) << std::endl;
+    }
 
     return EXIT_SUCCESS;
 }
@@ -1,147 +1,690 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <barrier>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <optional>
 #include <queue>
-#include <set>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 using IntType = std::int64_t;
-#define PART 2
 
-struct Node {
-    using Path = std::pair<Node *, IntType>;
-    Node(IntType height) : height(height) {}
+// The heightmap is stored as one byte per cell with a one cell border of SENTINEL on every side. Steps into or out of
+// the border always fail the climb check, so neighbours never need bounds checks. Rows are padded out to a whole number
+// of 64 cell words so that per-cell bitmaps never share a word between two rows.
+struct HeightMap {
+    static constexpr std::uint8_t SENTINEL = std::numeric_limits<std::uint8_t>::max();
+    static constexpr IntType ROW_ALIGN = 64;
 
-    IntType height;
-    IntType index;
-    std::vector<Path> transitions;
-    bool endpoint = false;
+    HeightMap() = default;
+    HeightMap(IntType width, IntType height)
+        : width(width), height(height), stride((width + 2 + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN),
+          cells(stride * (height + 2), SENTINEL)
+    {
+    }
 
-    // Pathfinding state
-    IntType node_value = std::numeric_limits<IntType>::max();
-    Node *parent = nullptr;
-};
+    IntType width = 0;
+    IntType height = 0;
+    IntType stride = 0;
+    std::vector<std::uint8_t> cells;
+    IntType start = -1;
+    IntType end = -1;
 
-struct Coordinate {
-    IntType x;
-    IntType y;
+    IntType index(IntType x, IntType y) const { return (y + 1) * stride + (x + 1); }
+    std::array<IntType, 4> neighbors(IntType idx) const { return {idx + 1, idx - 1, idx + stride, idx - stride}; }
 
-    Coordinate operator+(const Coordinate &rhs) const { return Coordinate{x + rhs.x, y + rhs.y}; }
+    // A step from -> to is allowed if it climbs at most one unit
+    bool can_step(IntType from, IntType to) const { return cells[from] != SENTINEL && cells[to] <= cells[from] + 1; }
 };
 
-static constexpr auto R = Coordinate{1, 0};
-static constexpr auto L = Coordinate{-1, 0};
-static constexpr auto U = Coordinate{0, 1};
-static constexpr auto D = Coordinate{0, -1};
-
-int main(int argc, char *argv[])
+HeightMap parse_heightmap(std::istream &input)
 {
-    std::ifstream input_data(argv[1], std::ios::in);
-    if (!input_data)
-        return EXIT_FAILURE;
-
-    // Read in the terrain and determine the extents
     std::vector<std::string> input_lines;
-    for (std::string line; std::getline(input_data, line); input_lines.push_back(line))
-        ;
-    IntType terrain_max_x = input_lines.front().size();
-    IntType terrain_max_y = input_lines.size();
-
-    // Load in the heights
-    std::vector<Node> terrain;
-    IntType insert_index = 0;
-    for (const auto &row : input_lines) {
-        for (const auto &elem : row) {
-            switch (elem) {
-            case 'S': {
-                auto &new_node = terrain.emplace_back(0);
-                new_node.endpoint = true;
-                new_node.node_value = 0;
+    for (std::string line; std::getline(input, line);)
+        if (!line.empty())
+            input_lines.push_back(line);
+
+    if (input_lines.empty())
+        return {};
+    HeightMap map(input_lines.front().size(), input_lines.size());
+
+    for (IntType y = 0; y < map.height; ++y) {
+        for (IntType x = 0; x < map.width && x < IntType(input_lines[y].size()); ++x) {
+            auto idx = map.index(x, y);
+            switch (auto elem = input_lines[y][x]) {
+            case 'S':
+                map.cells[idx] = 0;
+                map.start = idx;
                 break;
-            }
-            case 'E': {
-                auto &new_node = terrain.emplace_back('z' - 'a');
-                new_node.endpoint = true;
+            case 'E':
+                map.cells[idx] = 'z' - 'a';
+                map.end = idx;
                 break;
-            }
             default:
-                terrain.emplace_back(elem - 'a');
+                map.cells[idx] = elem - 'a';
                 break;
             }
-            terrain.back().index = insert_index++;
         }
     }
+    return map;
+}
 
-    // Determine the edge transitions. For Part 2, we set any transition between 'a' altitudes to be zero, so that
-    // the path to the endpoint will always "start" from the closest 'a' node.
-    auto get_node_from_xy = [terrain_max_x, terrain_max_y, &terrain](IntType x, IntType y) -> Node * {
-        if (x < 0 || x >= terrain_max_x)
-            return nullptr;
-        if (y < 0 || y >= terrain_max_y)
-            return nullptr;
-        return &terrain[y * terrain_max_x + x];
-    };
+// Shortest path length from every cell to the endpoint, stored row-major without the sentinel border. Once built, the
+// Part 1 and Part 2 answers and any "shortest path from (x, y)" query are single lookups.
+struct DistanceField {
+    static constexpr auto UNREACHED = std::numeric_limits<std::uint32_t>::max();
+    static constexpr char MAGIC[8] = {'D', '1', '2', 'F', 'I', 'E', 'L', 'D'};
+
+    IntType width = 0;
+    IntType height = 0;
+    IntType start = -1;
+    IntType end = -1;
+    std::uint32_t nearest_low = UNREACHED;
+    std::vector<std::uint32_t> distances;
+
+    std::optional<std::uint32_t> from(IntType x, IntType y) const
+    {
+        if (x < 0 || x >= width || y < 0 || y >= height || distances[y * width + x] == UNREACHED)
+            return {};
+        return distances[y * width + x];
+    }
 
-    auto get_coords_from_index = [terrain_max_x, &terrain](IntType idx) -> std::optional<Coordinate> {
-        if (idx >= terrain.size())
+    std::optional<std::uint32_t> part1() const
+    {
+        if (start < 0 || !width)
             return {};
-        return {{idx % terrain_max_x, idx / terrain_max_x}};
+        return from(start % width, start / width);
+    }
+    std::optional<std::uint32_t> part2() const
+    {
+        if (nearest_low == UNREACHED)
+            return {};
+        return nearest_low;
+    }
+
+    void save(std::ostream &out) const
+    {
+        out.write(MAGIC, sizeof(MAGIC));
+        for (auto value : {width, height, start, end})
+            out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+        out.write(reinterpret_cast<const char *>(&nearest_low), sizeof(nearest_low));
+        out.write(reinterpret_cast<const char *>(distances.data()), distances.size() * sizeof(std::uint32_t));
+    }
+
+    // Returns nothing if the stream does not hold a saved field
+    static std::optional<DistanceField> load(std::istream &in)
+    {
+        char magic[sizeof(MAGIC)] = {};
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)))
+            return {};
+
+        DistanceField field;
+        for (auto value : {&field.width, &field.height, &field.start, &field.end})
+            in.read(reinterpret_cast<char *>(value), sizeof(*value));
+        in.read(reinterpret_cast<char *>(&field.nearest_low), sizeof(field.nearest_low));
+        if (!in || field.width < 0 || field.height < 0)
+            return {};
+        field.distances.resize(field.width * field.height);
+        if (!in.read(reinterpret_cast<char *>(field.distances.data()), field.distances.size() * sizeof(std::uint32_t)))
+            return {};
+        return field;
+    }
+};
+
+// Strip the sentinel border from a search over the padded grid. Rows are compacted in place, since every unpadded row
+// starts at or before its padded position, so no second full size buffer is needed.
+DistanceField make_field(const HeightMap &map, std::vector<std::uint32_t> distances, std::uint32_t nearest_low)
+{
+    for (IntType y = 0; y < map.height; ++y)
+        std::copy_n(distances.begin() + map.index(0, y), map.width, distances.begin() + y * map.width);
+    distances.resize(map.width * map.height);
+
+    DistanceField field;
+    field.width = map.width;
+    field.height = map.height;
+    field.nearest_low = nearest_low;
+    field.distances = std::move(distances);
+
+    auto unpadded = [&map](IntType idx) { return (idx / map.stride - 1) * map.width + (idx % map.stride - 1); };
+    field.start = map.start < 0 ? -1 : unpadded(map.start);
+    field.end = map.end < 0 ? -1 : unpadded(map.end);
+    return field;
+}
+
+// Breadth first search backwards from the endpoint, following every edge in reverse. Cells are expanded one distance
+// level at a time, so the first height 0 cell reached is the Part 2 answer.
+DistanceField reverse_search(const HeightMap &map)
+{
+    std::vector<std::uint32_t> distances(map.cells.size(), DistanceField::UNREACHED);
+    auto nearest_low = DistanceField::UNREACHED;
+    if (map.end < 0)
+        return make_field(map, std::move(distances), nearest_low);
+
+    // Only the current and next levels are held, so the queue costs memory in proportion to the widest frontier
+    // rather than to the whole grid
+    std::vector<IntType> frontier{map.end};
+    std::vector<IntType> next;
+    distances[map.end] = 0;
+    for (std::uint32_t level = 0; !frontier.empty(); ++level) {
+        for (auto idx : frontier) {
+            if (map.cells[idx] == 0 && nearest_low == DistanceField::UNREACHED)
+                nearest_low = level;
+
+            for (auto neighbor : map.neighbors(idx)) {
+                if (distances[neighbor] != DistanceField::UNREACHED || !map.can_step(neighbor, idx))
+                    continue;
+                distances[neighbor] = level + 1;
+                next.push_back(neighbor);
+            }
+        }
+        frontier.swap(next);
+        next.clear();
+    }
+
+    return make_field(map, std::move(distances), nearest_low);
+}
+
+// Run fn(thread_idx, begin, end) over [0, count) split into one contiguous range per thread
+template <typename Fn>
+void parallel_for(IntType thread_count, IntType count, Fn &&fn)
+{
+    thread_count = std::max<IntType>(1, std::min(thread_count, count));
+    if (thread_count == 1) {
+        fn(0, 0, count);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    for (IntType thread_idx = 0; thread_idx < thread_count; ++thread_idx) {
+        auto begin = count * thread_idx / thread_count;
+        auto end = count * (thread_idx + 1) / thread_count;
+        workers.emplace_back([&fn, thread_idx, begin, end]() { fn(thread_idx, begin, end); });
+    }
+    for (auto &worker : workers)
+        worker.join();
+}
+
+// Level synchronous version of reverse_search for very large maps. The visited set is a bitmap over the padded grid,
+// every thread owns a band of rows, and a barrier closes each level. A level is expanded one of two ways:
+//  - top-down: the frontier cells are split evenly between the threads, and each claims the unvisited predecessors of
+//    its cells with an atomic or on the visited bitmap.
+//  - bottom-up: the frontier is laid out as a bitmap, and every unvisited cell in a band checks whether one of its
+//    successors is on it. Each thread only writes to its own band, so no atomics are needed.
+// Top-down costs work proportional to the frontier and bottom-up proportional to what is left to visit, so the
+// direction is picked again before every level from the size of the last frontier.
+DistanceField parallel_reverse_search(const HeightMap &map, IntType thread_count)
+{
+    static constexpr IntType BOTTOM_UP_RATIO = 16;
+    constexpr auto WORD_BITS = 64;
+    using Word = std::uint64_t;
+
+    std::vector<std::uint32_t> distances(map.cells.size(), DistanceField::UNREACHED);
+    auto nearest_low = DistanceField::UNREACHED;
+    if (map.end < 0 || !map.height)
+        return make_field(map, std::move(distances), nearest_low);
+
+    // Sentinels start out visited so they are never reached
+    const auto word_count = static_cast<IntType>(map.cells.size()) / WORD_BITS;
+    const auto row_words = map.stride / WORD_BITS;
+    std::vector<Word> visited(word_count, ~Word(0));
+    for (IntType y = 0; y < map.height; ++y)
+        for (auto idx = map.index(0, y); idx < map.index(map.width, y); ++idx)
+            visited[idx / WORD_BITS] &= ~(Word(1) << (idx % WORD_BITS));
+    visited[map.end / WORD_BITS] |= Word(1) << (map.end % WORD_BITS);
+    distances[map.end] = 0;
+    if (map.cells[map.end] == 0)
+        nearest_low = 0;
+
+    // The frontier is kept as the list of cells each thread reached on the last level, plus a bitmap copy of it that
+    // is only filled in for bottom-up levels
+    thread_count = std::max<IntType>(1, std::min(thread_count, map.height));
+    std::vector<std::vector<IntType>> frontier(thread_count);
+    std::vector<std::vector<IntType>> next(thread_count);
+    std::vector<IntType> frontier_offsets(thread_count + 1, 1);
+    frontier[0].push_back(map.end);
+    frontier_offsets[0] = 0;
+    std::vector<Word> frontier_bits(word_count, 0);
+    std::vector<Word> next_bits(word_count, 0);
+
+    struct alignas(64) BandResult {
+        IntType reached = 0;
+        bool reached_low = false;
+    };
+    std::vector<BandResult> results(thread_count);
+
+    std::uint32_t level = 0;
+    IntType unvisited = map.width * map.height - 1;
+    bool bottom_up = false;
+    bool frontier_bits_ready = false;
+    bool done = false;
+    auto end_level = [&]() noexcept {
+        IntType reached = 0;
+        bool reached_low = false;
+        for (auto &result : results) {
+            reached += result.reached;
+            reached_low |= result.reached_low;
+            result = {};
+        }
+        ++level;
+        if (reached_low && nearest_low == DistanceField::UNREACHED)
+            nearest_low = level;
+        unvisited -= reached;
+
+        frontier_bits_ready = bottom_up;
+        if (bottom_up)
+            std::swap(frontier_bits, next_bits);
+        for (IntType thread_idx = 0; thread_idx < IntType(frontier.size()); ++thread_idx) {
+            frontier[thread_idx].swap(next[thread_idx]);
+            next[thread_idx].clear();
+            frontier_offsets[thread_idx + 1] = frontier_offsets[thread_idx] + frontier[thread_idx].size();
+        }
+        bottom_up = reached * BOTTOM_UP_RATIO > unvisited;
+        done = !reached;
+    };
+    std::barrier step(thread_count);
+    std::barrier level_done(thread_count, end_level);
+
+    // Visit this thread's even share of all the frontier lists
+    auto for_each_frontier_cell = [&](IntType thread_idx, auto &&fn) {
+        auto total = frontier_offsets.back();
+        auto begin = total * thread_idx / thread_count;
+        auto end = total * (thread_idx + 1) / thread_count;
+        auto list_idx = std::upper_bound(frontier_offsets.begin(), frontier_offsets.end(), begin) -
+                        frontier_offsets.begin() - 1;
+        for (auto pos = begin; pos < end; ++pos) {
+            while (pos >= frontier_offsets[list_idx + 1])
+                ++list_idx;
+            fn(frontier[list_idx][pos - frontier_offsets[list_idx]]);
+        }
     };
 
-    for (auto idx = 0; idx < terrain.size(); ++idx) {
-        auto coordinate = get_coords_from_index(idx);
-        auto node = get_node_from_xy(coordinate->x, coordinate->y);
-
-        for (auto move : {R, L, U, D}) {
-            auto neighbor_coordinate = *coordinate + move;
-            if (auto neighbor = get_node_from_xy(neighbor_coordinate.x, neighbor_coordinate.y)) {
-                if constexpr (PART == 2) {
-                    if (neighbor->height == 0 && node->height == 0)
-                        node->transitions.emplace_back(neighbor, 0);
-                    else if (neighbor->height <= (node->height + 1))
-                        node->transitions.emplace_back(neighbor, 1);
+    parallel_for(thread_count, map.height, [&](IntType thread_idx, IntType row_begin, IntType row_end) {
+        const auto word_begin = (row_begin + 1) * row_words;
+        const auto word_end = (row_end + 1) * row_words;
+        auto &result = results[thread_idx];
+        auto &reached_cells = next[thread_idx];
+
+        while (!done) {
+            if (!bottom_up) {
+                for_each_frontier_cell(thread_idx, [&](IntType idx) {
+                    for (auto neighbor : map.neighbors(idx)) {
+                        auto bit = Word(1) << (neighbor % WORD_BITS);
+                        std::atomic_ref visited_word(visited[neighbor / WORD_BITS]);
+                        if ((visited_word.load(std::memory_order_relaxed) & bit) || !map.can_step(neighbor, idx))
+                            continue;
+                        if (visited_word.fetch_or(bit, std::memory_order_relaxed) & bit)
+                            continue;
+                        distances[neighbor] = level + 1;
+                        reached_cells.push_back(neighbor);
+                        ++result.reached;
+                        result.reached_low |= map.cells[neighbor] == 0;
+                    }
+                });
+            }
+            else {
+                if (!frontier_bits_ready) {
+                    std::fill(frontier_bits.begin() + word_begin, frontier_bits.begin() + word_end, 0);
+                    step.arrive_and_wait();
+                    for_each_frontier_cell(thread_idx, [&](IntType idx) {
+                        std::atomic_ref(frontier_bits[idx / WORD_BITS])
+                            .fetch_or(Word(1) << (idx % WORD_BITS), std::memory_order_relaxed);
+                    });
+                    step.arrive_and_wait();
                 }
-                else {
-                    if (neighbor->height <= (node->height + 1))
-                        node->transitions.emplace_back(neighbor, 1);
+
+                for (auto word_idx = word_begin; word_idx < word_end; ++word_idx) {
+                    // Only cells with a frontier cell to one side are worth checking
+                    auto near_frontier = (frontier_bits[word_idx] << 1) |
+                                         (frontier_bits[word_idx - 1] >> (WORD_BITS - 1)) |
+                                         (frontier_bits[word_idx] >> 1) |
+                                         (frontier_bits[word_idx + 1] << (WORD_BITS - 1)) |
+                                         frontier_bits[word_idx - row_words] | frontier_bits[word_idx + row_words];
+                    Word reached = 0;
+                    auto candidates = ~visited[word_idx] & near_frontier;
+                    for (; candidates; candidates &= candidates - 1) {
+                        auto idx = word_idx * WORD_BITS + std::countr_zero(candidates);
+                        for (auto neighbor : map.neighbors(idx)) {
+                            if (((frontier_bits[neighbor / WORD_BITS] >> (neighbor % WORD_BITS)) & 1) &&
+                                map.can_step(idx, neighbor)) {
+                                reached |= candidates & -candidates;
+                                distances[idx] = level + 1;
+                                reached_cells.push_back(idx);
+                                ++result.reached;
+                                result.reached_low |= map.cells[idx] == 0;
+                                break;
+                            }
+                        }
+                    }
+                    next_bits[word_idx] = reached;
+                    visited[word_idx] |= reached;
                 }
             }
+            level_done.arrive_and_wait();
         }
+    });
+
+    return make_field(map, std::move(distances), nearest_low);
+}
+
+// Keeps the distance field of a heightmap up to date while single cells change height, in the style of Lifelong
+// Planning A*. Next to its distance g, every cell keeps the one step lookahead rhs = 1 + the smallest g among the cells
+// it can step to. An edit only changes rhs for the edited cell and its neighbours; cells where g and rhs disagree are
+// queued by min(g, rhs) and settled in order, so only the region whose distances actually change is visited.
+struct IncrementalField {
+    struct Answers {
+        std::optional<std::uint32_t> part1;
+        std::optional<std::uint32_t> part2;
+    };
+
+    explicit IncrementalField(HeightMap terrain) : map(std::move(terrain)), g(map.cells.size(), UNREACHED)
+    {
+        auto field = reverse_search(map);
+        for (IntType y = 0; y < map.height; ++y)
+            std::copy_n(field.distances.begin() + y * map.width, map.width, g.begin() + map.index(0, y));
+        rhs = g;
+        for (IntType y = 0; y < map.height; ++y)
+            for (IntType x = 0; x < map.width; ++x)
+                track_low(map.index(x, y), true);
     }
 
-    // Run a pathfinding algorithm
-    auto node_compare = [](const Node *lhs, const Node *rhs) { return lhs->node_value > rhs->node_value; };
-    std::vector<Node *> node_pq;
-    std::set<Node *> visited_nodes;
+    Answers set_height(IntType x, IntType y, std::uint8_t height)
+    {
+        if (x < 0 || x >= map.width || y < 0 || y >= map.height)
+            throw std::runtime_error("Cell position out of range");
+        if (height > 'z' - 'a')
+            throw std::runtime_error("Invalid cell height");
 
-    for (auto &node : terrain)
-        node_pq.emplace_back(&node);
-    std::sort(node_pq.begin(), node_pq.end(), node_compare);
+        auto idx = map.index(x, y);
+        if (map.cells[idx] != height) {
+            track_low(idx, false);
+            map.cells[idx] = height;
+            track_low(idx, true);
 
-    while (node_pq.size()) {
-        if (node_pq.back()->endpoint && node_pq.back()->node_value)
-            break;
+            update_cell(idx);
+            for (auto neighbor : map.neighbors(idx))
+                update_cell(neighbor);
+            repair();
+        }
+        return answers();
+    }
 
-        visited_nodes.insert(node_pq.back());
-        for (auto edge : node_pq.back()->transitions) {
-            if (visited_nodes.count(edge.first))
+    Answers answers() const
+    {
+        Answers result;
+        if (map.start >= 0 && g[map.start] != UNREACHED)
+            result.part1 = g[map.start];
+        if (!low_distances.empty())
+            result.part2 = low_distances.begin()->first;
+        return result;
+    }
+
+    DistanceField field() const { return make_field(map, g, answers().part2.value_or(UNREACHED)); }
+    const HeightMap &get_map() const { return map; }
+
+  protected:
+    static constexpr auto UNREACHED = DistanceField::UNREACHED;
+    using QueueEntry = std::pair<std::uint32_t, IntType>;
+
+    // Count reachable height 0 cells by distance, so Part 2 is the smallest key
+    void track_low(IntType idx, bool add)
+    {
+        if (map.cells[idx] != 0 || g[idx] == UNREACHED)
+            return;
+        if (add)
+            ++low_distances[g[idx]];
+        else if (--low_distances[g[idx]] == 0)
+            low_distances.erase(g[idx]);
+    }
+
+    void set_distance(IntType idx, std::uint32_t distance)
+    {
+        track_low(idx, false);
+        g[idx] = distance;
+        track_low(idx, true);
+    }
+
+    // Recompute rhs for a cell and queue it if it is now inconsistent
+    void update_cell(IntType idx)
+    {
+        if (map.cells[idx] == HeightMap::SENTINEL)
+            return;
+        if (idx != map.end) {
+            auto best = UNREACHED;
+            for (auto neighbor : map.neighbors(idx))
+                if (g[neighbor] != UNREACHED && map.can_step(idx, neighbor))
+                    best = std::min(best, g[neighbor] + 1);
+            rhs[idx] = best;
+        }
+        if (g[idx] != rhs[idx])
+            queue.emplace(std::min(g[idx], rhs[idx]), idx);
+    }
+
+    void repair()
+    {
+        while (!queue.empty()) {
+            auto [key, idx] = queue.top();
+            queue.pop();
+            // Skip entries that were superseded after they were queued
+            if (g[idx] == rhs[idx] || key != std::min(g[idx], rhs[idx]))
                 continue;
-            auto candidate_new_node_val = node_pq.back()->node_value + edge.second;
-            if (candidate_new_node_val < edge.first->node_value) {
-                edge.first->node_value = candidate_new_node_val;
-                edge.first->parent = node_pq.back();
+
+            // A cell that got closer settles at once. A cell that got further away is reset to unreached and queued
+            // again at its new lookahead distance; either way the cells that step onto it need a new rhs.
+            if (g[idx] > rhs[idx]) {
+                set_distance(idx, rhs[idx]);
+            }
+            else {
+                set_distance(idx, UNREACHED);
+                update_cell(idx);
             }
+            for (auto neighbor : map.neighbors(idx))
+                if (map.can_step(neighbor, idx))
+                    update_cell(neighbor);
         }
-        node_pq.pop_back();
-        std::sort(node_pq.begin(), node_pq.end(), node_compare);
     }
 
-    for (auto &node : terrain) {
-        if (node.endpoint && node.node_value) {
-            std::cout << "Endpoint node has value: " << node.node_value << std::endl;
-            break;
+    HeightMap map;
+    std::vector<std::uint32_t> g;
+    std::vector<std::uint32_t> rhs;
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<>> queue;
+    std::map<std::uint32_t, IntType> low_distances;
+};
+
+// Generate a width x height map that climbs from west to east with some noise, so most of it is reachable from the
+// east edge and the search runs for roughly width + height levels
+HeightMap generate_heightmap(IntType width, IntType height)
+{
+    HeightMap map(width, height);
+    std::mt19937 rng(12);
+    std::uniform_int_distribution<int> noise(-1, 1);
+    for (IntType y = 0; y < height; ++y) {
+        for (IntType x = 0; x < width; ++x) {
+            auto base = static_cast<int>(x * 26 / width);
+            map.cells[map.index(x, y)] = static_cast<std::uint8_t>(std::clamp(base + noise(rng), 0, 25));
         }
     }
+    if (width && height) {
+        map.start = map.index(0, height / 2);
+        map.end = map.index(width - 1, height / 2);
+        map.cells[map.start] = 0;
+        map.cells[map.end] = 'z' - 'a';
+    }
+    return map;
+}
+
+void benchmark(IntType width, IntType height)
+{
+    auto map = generate_heightmap(width, height);
+
+    auto elapsed_ms = [](auto start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::cout << "Heightmap: " << width << "x" << height << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    auto reference = reverse_search(map);
+    auto baseline_ms = elapsed_ms(start);
+    std::cout << "Sequential: " << baseline_ms << " ms (Part 1 " << reference.part1().value_or(0) << ", Part 2 "
+              << reference.part2().value_or(0) << ")" << std::endl;
+
+    for (IntType thread_count : {1, 2, 4, 8, 16}) {
+        start = std::chrono::steady_clock::now();
+        auto field = parallel_reverse_search(map, thread_count);
+        auto search_ms = elapsed_ms(start);
+        std::cout << "Threads: " << thread_count << ", Time: " << search_ms << " ms, Speedup: "
+                  << baseline_ms / search_ms << "x" << std::endl;
+        if (field.distances != reference.distances || field.nearest_low != reference.nearest_low)
+            std::cout << "Parallel distance field differs from the sequential search!" << std::endl;
+    }
+
+    if (!width || !height)
+        return;
+    start = std::chrono::steady_clock::now();
+    IncrementalField incremental(std::move(map));
+    std::cout << "Incremental setup: " << elapsed_ms(start) << " ms" << std::endl;
+
+    static constexpr IntType UPDATES = 1000;
+    std::mt19937 rng(47);
+    std::uniform_int_distribution<IntType> x_dist(0, width - 1);
+    std::uniform_int_distribution<IntType> y_dist(0, height - 1);
+    std::uniform_int_distribution<int> height_dist(0, 'z' - 'a');
+    start = std::chrono::steady_clock::now();
+    for (IntType update = 0; update < UPDATES; ++update)
+        incremental.set_height(x_dist(rng), y_dist(rng), static_cast<std::uint8_t>(height_dist(rng)));
+    auto update_us = elapsed_ms(start) * 1000 / UPDATES;
+
+    start = std::chrono::steady_clock::now();
+    auto full = reverse_search(incremental.get_map());
+    auto full_ms = elapsed_ms(start);
+    auto answers = incremental.answers();
+    std::cout << "Update latency: " << update_us << " us, Full recompute: " << full_ms << " ms (Part 1 "
+              << answers.part1.value_or(0) << ", Part 2 " << answers.part2.value_or(0) << ")" << std::endl;
+    if (incremental.field().distances != full.distances || answers.part2 != full.part2())
+        std::cout << "Incremental distance field differs from a full recompute!" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && std::string_view(argv[1]) == "--bench") {
+        IntType width = argc > 2 ? std::atoll(argv[2]) : 8000;
+        IntType height = argc > 3 ? std::atoll(argv[3]) : width;
+        benchmark(width, height);
+        return EXIT_SUCCESS;
+    }
+
+    std::ifstream input_data(argv[1], std::ios::in | std::ios::binary);
+    if (!input_data)
+        return EXIT_FAILURE;
+
+    auto print = [](std::optional<std::uint32_t> distance) -> std::ostream & {
+        if (distance)
+            return std::cout << *distance;
+        return std::cout << "unreachable";
+    };
+
+    // The input is either a heightmap or a distance field saved by an earlier '--save=<file>' run
+    auto field = DistanceField::load(input_data);
+    if (field) {
+        // A saved field has no heights left to edit
+        for (int arg_idx = 2; arg_idx < argc; ++arg_idx) {
+            std::string_view arg(argv[arg_idx]);
+            if (arg.substr(0, 2) != "--" && arg.find('=') != std::string_view::npos) {
+                std::cerr << "Edit '" << arg << "' needs a heightmap input, not a saved distance field" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    else {
+        input_data.clear();
+        input_data.seekg(0);
+        auto map = parse_heightmap(input_data);
+        if (map.start < 0 || map.end < 0)
+            return EXIT_FAILURE;
+
+        IntType thread_count = 1;
+        struct Edit {
+            IntType x;
+            IntType y;
+            char letter;
+        };
+        std::vector<Edit> edits;
+        for (int arg_idx = 2; arg_idx < argc; ++arg_idx) {
+            std::string_view arg(argv[arg_idx]);
+            auto sep = arg.find(',');
+            auto eq = arg.find('=');
+            if (arg.substr(0, 10) == "--threads=") {
+                thread_count = std::atoll(argv[arg_idx] + 10);
+            }
+            else if (arg.substr(0, 2) != "--" && eq != std::string_view::npos) {
+                // Check every 'x,y=<letter>' edit up front, before any search runs
+                auto invalid = [arg]() {
+                    std::cerr << "Invalid edit '" << arg << "', expected x,y=<a-z> within the map" << std::endl;
+                    return EXIT_FAILURE;
+                };
+                if (sep == std::string_view::npos || sep > eq || eq + 2 != arg.size())
+                    return invalid();
+                Edit edit{std::atoll(argv[arg_idx]), std::atoll(argv[arg_idx] + sep + 1), arg.back()};
+                if (edit.letter < 'a' || edit.letter > 'z' || edit.x < 0 || edit.x >= map.width || edit.y < 0 ||
+                    edit.y >= map.height)
+                    return invalid();
+                edits.push_back(edit);
+            }
+        }
+
+        if (edits.empty()) {
+            field = thread_count > 1 ? parallel_reverse_search(map, thread_count) : reverse_search(map);
+        }
+        else {
+            // Apply the edits one at a time, repairing the field after each
+            IncrementalField incremental(std::move(map));
+            for (const auto &edit : edits) {
+                auto answers = incremental.set_height(edit.x, edit.y, static_cast<std::uint8_t>(edit.letter - 'a'));
+                std::cout << "After setting (" << edit.x << ", " << edit.y << ") to '" << edit.letter << "': Part 1 ";
+                print(answers.part1) << ", Part 2 ";
+                print(answers.part2) << std::endl;
+            }
+            field = incremental.field();
+        }
+    }
+
+    // Further arguments are '--threads=<n>', '--save=<file>', 'x,y=<letter>' edits or 'x,y' cells to query
+    for (int arg_idx = 2; arg_idx < argc; ++arg_idx) {
+        std::string_view arg(argv[arg_idx]);
+        if (arg.substr(0, 7) == "--save=") {
+            std::ofstream out(argv[arg_idx] + 7, std::ios::out | std::ios::binary);
+            field->save(out);
+            if (!out)
+                return EXIT_FAILURE;
+        }
+    }
+
+    std::cout << "Shortest path from the start (Part 1): ";
+    print(field->part1()) << std::endl;
+    std::cout << "Shortest path from any 'a' (Part 2): ";
+    print(field->part2()) << std::endl;
+
+    for (int arg_idx = 2; arg_idx < argc; ++arg_idx) {
+        std::string_view arg(argv[arg_idx]);
+        auto sep = arg.find(',');
+        if (arg.substr(0, 2) == "--" || sep == std::string_view::npos || arg.find('=') != std::string_view::npos)
+            continue;
+        auto x = std::atoll(argv[arg_idx]);
+        auto y = std::atoll(argv[arg_idx] + sep + 1);
+        std::cout << "Shortest path from (" << x << ", " << y << "): ";
+        print(field->from(x, y)) << std::endl;
+    }
 
     return EXIT_SUCCESS;
 }
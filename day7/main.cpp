@@ -1,19 +1,81 @@
+#include <chrono>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <map>
-#include <regex>
 #include <set>
 #include <stack>
 #include <string>
+#include <string_view>
+#include <thread>
 
 using IntType = std::int64_t;
 
+enum class LineKind { ChangeDir, List, Dir, File, Unknown };
+
+struct LogLine {
+    LineKind kind = LineKind::Unknown;
+    std::string_view name;
+    IntType size = 0;
+};
+
+// Classify a terminal log line by its leading bytes. The returned name is a view into the line, so it is only valid for
+// as long as the line's storage is.
+LogLine classify(std::string_view line)
+{
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+    if (line.size() < 3)
+        return {};
+
+    switch (line[0]) {
+    case '$':
+        if (line[1] != ' ')
+            return {};
+        if (line.size() > 5 && line[2] == 'c' && line[3] == 'd' && line[4] == ' ')
+            return {LineKind::ChangeDir, line.substr(5)};
+        if (line.size() == 4 && line[2] == 'l' && line[3] == 's')
+            return {LineKind::List};
+        return {};
+    case 'd':
+        if (line.size() > 4 && line[1] == 'i' && line[2] == 'r' && line[3] == ' ')
+            return {LineKind::Dir, line.substr(4)};
+        return {};
+    default:
+        break;
+    }
+
+    IntType size = 0;
+    std::size_t pos = 0;
+    for (; pos < line.size() && line[pos] >= '0' && line[pos] <= '9'; ++pos)
+        size = size * 10 + (line[pos] - '0');
+    if (pos == 0 || pos + 1 >= line.size() || line[pos] != ' ')
+        return {};
+    return {LineKind::File, line.substr(pos + 1), size};
+}
+
 struct Directory {
+    Directory(Directory *parent = nullptr) : parent(parent) {}
+
+    // Returns the new directory, or nullptr if it was already known
+    Directory *add_directory(std::string_view name)
+    {
+        auto [itr, inserted] = directories.try_emplace(std::string(name), this);
+        return inserted ? &(itr->second) : nullptr;
+    }
 
-    void add_directory(const std::string &name) { directories[name] = Directory(); }
-    void add_file(const std::string &name, IntType size) { files[name] = size; }
+    // Returns the change in this directory's own file total
+    IntType add_file(std::string_view name, IntType size)
+    {
+        auto [itr, inserted] = files.try_emplace(std::string(name), size);
+        if (inserted)
+            return size;
+        auto delta = size - itr->second;
+        itr->second = size;
+        return delta;
+    }
 
-    Directory *get_directory(const std::string &name)
+    Directory *get_directory(std::string_view name)
     {
         if (auto res = directories.find(name); res != directories.cend()) {
             return &(res->second);
@@ -33,92 +95,170 @@ struct Directory {
         return os;
     }
 
-    std::size_t size() const
+    IntType size() const { return total_size; }
+
+  protected:
+    friend struct Session;
+
+    Directory *parent;
+    IntType total_size = 0;
+    std::map<std::string, Directory, std::less<>> directories;
+    std::map<std::string, IntType, std::less<>> files;
+};
+
+// Replays a terminal log into a directory tree. Directory sizes are cached and kept in an ordered index, so both
+// answers can be re-queried cheaply after any number of appended lines.
+struct Session {
+    static constexpr IntType SMALL_DIR_LIMIT = 100000;
+    static constexpr IntType SPACE_REQUIRED = 30000000;
+    static constexpr IntType FILESYSTEM_SPACE = 70000000;
+
+    Session()
     {
-        IntType total_size = 0;
-        for (const auto &dir_entry : directories)
-            total_size += dir_entry.second.size();
-        for (const auto &file_entry : files)
-            total_size += file_entry.second;
-        return total_size;
+        dir_stack.push(&root_dir);
+        dir_sizes.insert(0);
+        small_dir_total = 0;
     }
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
 
-    void sum_dirs_less_than_size(IntType max_size, IntType &accumulator)
+    void apply(std::string_view entry)
     {
-        auto this_dir_size = size();
-        accumulator += this_dir_size <= max_size ? this_dir_size : 0;
-        for (auto &subdir : directories)
-            subdir.second.sum_dirs_less_than_size(max_size, accumulator);
-    };
+        auto line = classify(entry);
+        switch (line.kind) {
+        case LineKind::ChangeDir:
+            if (line.name == "/") {
+                dir_stack = std::stack<Directory *>();
+                dir_stack.push(&root_dir);
+            }
+            else if (line.name == "..") {
+                if (dir_stack.size() > 1)
+                    dir_stack.pop();
+            }
+            else {
+                // A transcript may enter a directory before listing its parent, so create it on the way in
+                auto next_dir = dir_stack.top()->get_directory(line.name);
+                if (!next_dir) {
+                    next_dir = dir_stack.top()->add_directory(line.name);
+                    dir_sizes.insert(0);
+                }
+                dir_stack.push(next_dir);
+            }
+            break;
+        case LineKind::Dir:
+            if (dir_stack.top()->add_directory(line.name))
+                dir_sizes.insert(0);
+            break;
+        case LineKind::File:
+            propagate(dir_stack.top(), dir_stack.top()->add_file(line.name, line.size));
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Applies every complete line in the buffer and returns the number of bytes consumed
+    std::size_t apply_lines(std::string_view buffer)
+    {
+        std::size_t consumed = 0;
+        for (auto eol = buffer.find('\n'); eol != std::string_view::npos; eol = buffer.find('\n', consumed)) {
+            apply(buffer.substr(consumed, eol - consumed));
+            consumed = eol + 1;
+        }
+        return consumed;
+    }
+
+    // Part 1 -- The sum of all directories where (size <= 100000)
+    IntType part1() const { return small_dir_total; }
 
-    void get_all_directory_sizes(std::set<IntType> &accumulator)
+    // Part 2 -- The smallest directory that frees enough space when deleted
+    IntType part2() const
     {
-        accumulator.insert(size());
-        for (auto &subdir : directories)
-            subdir.second.get_all_directory_sizes(accumulator);
+        auto deletion_requirement = SPACE_REQUIRED - (FILESYSTEM_SPACE - root_dir.size());
+        return *dir_sizes.lower_bound(deletion_requirement);
     }
 
+    const Directory &root() const { return root_dir; }
+
   protected:
-    std::map<std::string, Directory> directories;
-    std::map<std::string, IntType> files;
+    void resize(Directory *dir, IntType new_size)
+    {
+        auto old_size = dir->total_size;
+        dir_sizes.erase(dir_sizes.find(old_size));
+        dir_sizes.insert(new_size);
+        small_dir_total -= old_size <= SMALL_DIR_LIMIT ? old_size : 0;
+        small_dir_total += new_size <= SMALL_DIR_LIMIT ? new_size : 0;
+        dir->total_size = new_size;
+    }
+
+    void propagate(Directory *dir, IntType delta)
+    {
+        if (!delta)
+            return;
+        for (; dir; dir = dir->parent)
+            resize(dir, dir->total_size + delta);
+    }
+
+    Directory root_dir;
+    std::stack<Directory *> dir_stack;
+    std::multiset<IntType> dir_sizes;
+    IntType small_dir_total;
 };
 
 int main(int argc, char *argv[])
 {
-    std::ifstream input_data(argv[1], std::ios::in);
+    if (argc < 2)
+        return EXIT_FAILURE;
+    const std::filesystem::path log_path(argv[1]);
+    const bool follow = argc > 2 && std::string_view(argv[2]) == "--follow";
+
+    std::ifstream input_data(log_path, std::ios::in | std::ios::binary);
     if (!input_data)
         return EXIT_FAILURE;
 
-    Directory root_dir;
+    // Read whatever has been appended to the log since the last call. Lines are handed to the session as views into
+    // this buffer; any trailing partial line is kept until its newline arrives.
+    std::string pending;
+    std::uintmax_t offset = 0;
+    auto read_appended = [&]() -> bool {
+        std::error_code ec;
+        auto file_size = std::filesystem::file_size(log_path, ec);
+        if (ec || file_size <= offset)
+            return false;
+        auto prev_size = pending.size();
+        pending.resize(prev_size + (file_size - offset));
+        input_data.clear();
+        input_data.seekg(static_cast<std::streamoff>(offset));
+        input_data.read(pending.data() + prev_size, static_cast<std::streamsize>(file_size - offset));
+        pending.resize(prev_size + input_data.gcount());
+        offset += input_data.gcount();
+        return true;
+    };
 
-    // Parse the input and build out the tree. '$ ls' doesn't mean anything to us.
-    std::regex cd_regex("\\$ cd ([\\.\\/A-Za-z]+)");
-    std::regex dir_regex("dir ([A-Za-z]+)");
-    std::regex file_regex("([0-9]+) ([A-Za-z\\.]+)");
+    Session session;
+    auto report = [&session]() {
+        std::cout << "Part 1: " << session.part1() << std::endl;
+        std::cout << "Part 2: " << session.part2() << std::endl;
+    };
 
-    std::stack<Directory *> dir_stack;
-    dir_stack.push(&root_dir);
+    read_appended();
+    pending.erase(0, session.apply_lines(pending));
+    if (!follow) {
+        if (!pending.empty())
+            session.apply(pending);
+        report();
+        return EXIT_SUCCESS;
+    }
 
-    for (std::string entry; std::getline(input_data, entry);) {
-        std::smatch cmd_match;
-        if (std::regex_search(entry, cmd_match, cd_regex)) {
-            const auto &arg = cmd_match.str(1);
-            if (arg == "/") {
-                dir_stack = std::stack<Directory *>();
-                dir_stack.push(&root_dir);
-            }
-            else if (arg == "..")
-                dir_stack.pop();
-            else {
-                if (auto next_dir = dir_stack.top()->get_directory(arg))
-                    dir_stack.push(next_dir);
-                else
-                    throw std::runtime_error("Requested directory not found!");
-            }
-        }
-        else if (std::regex_search(entry, cmd_match, dir_regex)) {
-            dir_stack.top()->add_directory(cmd_match.str(1));
-        }
-        else if (std::regex_search(entry, cmd_match, file_regex)) {
-            dir_stack.top()->add_file(cmd_match.str(2), std::atoll(cmd_match.str(1).c_str()));
+    // Follow mode -- keep the tree alive and only apply lines appended to the log, like `tail -f`
+    report();
+    for (;;) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+        if (!read_appended())
+            continue;
+        if (auto consumed = session.apply_lines(pending)) {
+            pending.erase(0, consumed);
+            report();
         }
     }
-
-    // Part 1 -- Find the sum of all directories where (size <= 100000)
-    IntType part1 = 0;
-    root_dir.sum_dirs_less_than_size(100000, part1);
-    std::cout << "Part 1: " << part1 << std::endl;
-
-    // Part 2 -- Find smallest directory to delete
-    const IntType space_required = 30000000;
-    const IntType filesystem_space = 70000000;
-    auto unused_space = filesystem_space - root_dir.size();
-    auto deletion_requirement = space_required - unused_space;
-
-    std::set<IntType> part2;
-    root_dir.get_all_directory_sizes(part2);
-    auto smallest_thing_to_delete = part2.lower_bound(deletion_requirement);
-    std::cout << "Part 2: " << *smallest_thing_to_delete << std::endl;
-
-    return EXIT_SUCCESS;
 }
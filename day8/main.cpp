@@ -1,97 +1,435 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <new>
+#include <random>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 using IntType = std::int64_t;
+using Height = std::uint8_t;
+using LineScore = std::uint64_t;
+
+// Allocator for storage aligned to ALIGN bytes, which std::allocator does not promise for small element types
+template <typename T, std::size_t ALIGN>
+struct AlignedAllocator {
+    using value_type = T;
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, ALIGN>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, ALIGN> &)
+    {
+    }
+
+    T *allocate(std::size_t count)
+    {
+        return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(ALIGN)));
+    }
+    void deallocate(T *ptr, std::size_t) { ::operator delete(ptr, std::align_val_t(ALIGN)); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, ALIGN> &) const
+    {
+        return true;
+    }
+};
 
 struct Forest {
+    // Rows start on a cache line boundary: the buffer is ROW_ALIGN byte aligned and the row stride is padded to a
+    // multiple of ROW_ALIGN. Column bands are transposed in square tiles.
+    static constexpr IntType ROW_ALIGN = 64;
+    static constexpr IntType TILE = 64;
+
     Forest(const std::vector<std::string> &tree_rows)
-        : edge_len(tree_rows[0].size()), tree_heights(edge_len * edge_len, 0)
+        : width(tree_rows.empty() ? 0 : trimmed_len(tree_rows[0])), height(tree_rows.size()),
+          stride((width + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN), tree_heights(stride * height, 0)
     {
-        if (tree_rows.size() != edge_len)
-            throw std::runtime_error("Forest not square");
-        for (auto row_idx = 0; row_idx < edge_len; ++row_idx) {
+        for (IntType row_idx = 0; row_idx < height; ++row_idx) {
             const auto &row = tree_rows[row_idx];
-            if (row.size() != edge_len)
+            if (trimmed_len(row) != width)
                 throw std::runtime_error("Inconsistent tree row length");
-            auto row_offset = row_idx * edge_len;
-            for (auto col_idx = 0; col_idx < edge_len; ++col_idx)
-                tree_heights[row_offset + col_idx] = std::atoll(row.substr(col_idx, 1).c_str());
+            auto *dst = tree_heights.data() + row_idx * stride;
+            for (IntType col_idx = 0; col_idx < width; ++col_idx) {
+                if (row[col_idx] < '0' || row[col_idx] > '9')
+                    throw std::runtime_error("Invalid tree height");
+                dst[col_idx] = static_cast<Height>(row[col_idx] - '0');
+            }
         }
     }
 
-    struct Iterator {
-        using iterator_category = std::bidirectional_iterator_tag;
-        using difference_type = std::ptrdiff_t;
-        using value_type = IntType;
-        using pointer = value_type *;
-        using reference = value_type &;
+    Forest(IntType width, IntType height)
+        : width(width), height(height), stride((width + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN),
+          tree_heights(stride * height, 0)
+    {
+    }
+
+    IntType get_width() const { return width; }
+    IntType get_height() const { return height; }
+    const Height *row(IntType idx) const { return tree_heights.data() + idx * stride; }
+    Height *row(IntType idx) { return tree_heights.data() + idx * stride; }
 
-        Iterator(std::vector<IntType> *forest_array, IntType start_idx, IntType stride)
-            : forest_arr(forest_array), index(start_idx), stride(stride)
-        {
+    // Copy columns [col_begin, col_begin + col_count) into out, one column after another, so that a column can be
+    // swept as a contiguous line. The copy walks TILE x TILE blocks so both sides stay cache resident.
+    void transpose_band(IntType col_begin, IntType col_count, Height *out) const
+    {
+        for (IntType row_tile = 0; row_tile < height; row_tile += TILE) {
+            auto row_tile_end = std::min(row_tile + TILE, height);
+            for (IntType col_tile = 0; col_tile < col_count; col_tile += TILE) {
+                auto col_tile_end = std::min(col_tile + TILE, col_count);
+                for (auto row_idx = row_tile; row_idx < row_tile_end; ++row_idx) {
+                    const auto *src = row(row_idx) + col_begin;
+                    for (auto col_idx = col_tile; col_idx < col_tile_end; ++col_idx)
+                        out[col_idx * height + row_idx] = src[col_idx];
+                }
+            }
         }
-        Iterator(const Iterator &) = default;
-        Iterator(Iterator &&) = default;
-        Iterator &operator=(const Iterator &) = default;
-        Iterator &operator=(Iterator &&) = default;
-
-        reference operator*() const { return forest_arr->at(index); }
-        pointer operator->() { return forest_arr->data() + index; }
-        bool operator==(const Iterator &rhs) const
-        {
-            return (forest_arr == rhs.forest_arr && index == rhs.index && stride == rhs.stride);
+    }
+
+  protected:
+    static IntType trimmed_len(const std::string &row)
+    {
+        return !row.empty() && row.back() == '\r' ? row.size() - 1 : row.size();
+    }
+
+    const IntType width;
+    const IntType height;
+    const IntType stride;
+    std::vector<Height, AlignedAllocator<Height, ROW_ALIGN>> tree_heights;
+};
+
+// Sweep a contiguous line of trees from both ends. A tree taller than the running maximum is visible from that end, and
+// a monotonic stack of the trees still in view gives its viewing distance back towards that end. The two distances are
+// multiplied together in 64 bits, so lines of any length that fits in memory are scored exactly, and so is the product
+// of a row score and a column score for forests under 2^34 trees.
+void sweep_line(const Height *line, IntType len, Height *visible, LineScore *scenic, std::vector<IntType> &in_view)
+{
+    in_view.clear();
+    int running_max = -1;
+    for (IntType pos = 0; pos < len; ++pos) {
+        int tree = line[pos];
+        visible[pos] = tree > running_max;
+        running_max = std::max(running_max, tree);
+
+        // Anything shorter than this tree can never block a view from further along the line
+        while (!in_view.empty() && line[in_view.back()] < tree)
+            in_view.pop_back();
+        scenic[pos] = in_view.empty() ? pos : pos - in_view.back();
+        in_view.push_back(pos);
+    }
+
+    in_view.clear();
+    running_max = -1;
+    for (auto pos = len - 1; pos >= 0; --pos) {
+        int tree = line[pos];
+        visible[pos] |= tree > running_max;
+        running_max = std::max(running_max, tree);
+
+        while (!in_view.empty() && line[in_view.back()] < tree)
+            in_view.pop_back();
+        scenic[pos] *= in_view.empty() ? (len - 1 - pos) : in_view.back() - pos;
+        in_view.push_back(pos);
+    }
+}
+
+struct Survey {
+    IntType visible_count = 0;
+    IntType max_scenic_score = 0;
+};
+
+// Split [0, count) into contiguous chunks and run fn(thread_idx, begin, end) for each on its own thread
+template <typename Fn>
+void parallel_for(IntType thread_count, IntType count, Fn &&fn)
+{
+    thread_count = std::max<IntType>(1, std::min(thread_count, count));
+    if (thread_count == 1) {
+        fn(0, 0, count);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    for (IntType thread_idx = 0; thread_idx < thread_count; ++thread_idx) {
+        auto begin = count * thread_idx / thread_count;
+        auto end = count * (thread_idx + 1) / thread_count;
+        workers.emplace_back([&fn, thread_idx, begin, end]() { fn(thread_idx, begin, end); });
+    }
+    for (auto &worker : workers)
+        worker.join();
+}
+
+// Sweep every row straight over the height buffer, one band of rows per thread
+void row_pass(const Forest &forest, IntType thread_count, Height *row_visible, LineScore *row_scenic)
+{
+    const auto width = forest.get_width();
+    parallel_for(thread_count, forest.get_height(), [&](IntType, IntType row_begin, IntType row_end) {
+        std::vector<IntType> in_view;
+        for (auto row_idx = row_begin; row_idx < row_end; ++row_idx) {
+            auto offset = row_idx * width;
+            sweep_line(forest.row(row_idx), width, row_visible + offset, row_scenic + offset, in_view);
         }
-        bool operator!=(const Iterator &rhs) const { return !(*this == rhs); }
+    });
+}
+
+// Sweep every column over transposed bands of columns, one run of bands per thread. Results are handed back tile by
+// tile as visit(thread_idx, cell, visible, scenic), where cell is the row-major index of the tree.
+template <typename Visit>
+IntType column_pass(const Forest &forest, IntType thread_count, Visit &&visit)
+{
+    const auto width = forest.get_width();
+    const auto height = forest.get_height();
+    const auto band_width = std::min(Forest::TILE, width);
+    const auto band_count = band_width ? (width + band_width - 1) / band_width : 0;
+
+    parallel_for(thread_count, band_count, [&](IntType thread_idx, IntType first_band, IntType last_band) {
+        std::vector<IntType> in_view;
+        std::vector<Height> band(band_width * height);
+        std::vector<Height> col_visible(band_width * height);
+        std::vector<LineScore> col_scenic(band_width * height);
+
+        for (auto band_idx = first_band; band_idx < last_band; ++band_idx) {
+            auto band_begin = band_idx * band_width;
+            auto band_cols = std::min(band_width, width - band_begin);
+            forest.transpose_band(band_begin, band_cols, band.data());
+            for (IntType col_idx = 0; col_idx < band_cols; ++col_idx) {
+                auto offset = col_idx * height;
+                sweep_line(band.data() + offset, height, col_visible.data() + offset, col_scenic.data() + offset,
+                           in_view);
+            }
 
-        Iterator &operator++()
-        {
-            index += stride;
-            return *this;
+            for (IntType row_tile = 0; row_tile < height; row_tile += Forest::TILE) {
+                auto row_tile_end = std::min(row_tile + Forest::TILE, height);
+                for (IntType col_idx = 0; col_idx < band_cols; ++col_idx) {
+                    for (auto row_idx = row_tile; row_idx < row_tile_end; ++row_idx) {
+                        auto band_cell = col_idx * height + row_idx;
+                        visit(thread_idx, row_idx * width + band_begin + col_idx, col_visible[band_cell],
+                              col_scenic[band_cell]);
+                    }
+                }
+            }
         }
+    });
+    return std::max<IntType>(1, std::min(thread_count, band_count));
+}
 
-        Iterator operator++(int)
-        {
-            Iterator tmp = *this;
-            ++(*this);
-            return tmp;
+Survey survey_forest(const Forest &forest, IntType thread_count = 1)
+{
+    const auto width = forest.get_width();
+    const auto height = forest.get_height();
+
+    std::vector<Height> row_visible(width * height);
+    std::vector<LineScore> row_scenic(width * height);
+    row_pass(forest, thread_count, row_visible.data(), row_scenic.data());
+
+    // Each thread reduces its columns into its own partial survey, which are combined at the end. Partials are padded
+    // to a cache line each so the threads never write to a shared line.
+    struct alignas(64) Partial {
+        Survey survey;
+    };
+    std::vector<Partial> partials(std::max<IntType>(1, thread_count));
+    auto used_threads = column_pass(forest, thread_count, [&](IntType thread_idx, IntType cell, Height col_visible,
+                                                              LineScore col_scenic) {
+        auto &partial = partials[thread_idx].survey;
+        partial.visible_count += row_visible[cell] | col_visible;
+        partial.max_scenic_score =
+            std::max(partial.max_scenic_score, static_cast<IntType>(std::uint64_t(row_scenic[cell]) * col_scenic));
+    });
+
+    Survey result;
+    for (IntType thread_idx = 0; thread_idx < used_threads; ++thread_idx) {
+        result.visible_count += partials[thread_idx].survey.visible_count;
+        result.max_scenic_score = std::max(result.max_scenic_score, partials[thread_idx].survey.max_scenic_score);
+    }
+    return result;
+}
+
+// Keeps the sweep results for every tree so that changing one tree's height only re-sweeps its row and column. The
+// maximum scenic score is tracked over blocks of BLOCK trees within a row, with a max segment tree over the blocks.
+struct ForestSurvey {
+    static constexpr IntType BLOCK = 64;
+    static constexpr Height ROW_VISIBLE = 1;
+    static constexpr Height COL_VISIBLE = 2;
+
+    ForestSurvey(Forest &&initial_forest, IntType thread_count = 1)
+        : forest(std::move(initial_forest)), width(forest.get_width()), height(forest.get_height()),
+          blocks_per_row((width + BLOCK - 1) / BLOCK), visible(width * height), row_scenic(width * height),
+          col_scenic(width * height), block_tree(2 * blocks_per_row * height, 0)
+    {
+        row_pass(forest, thread_count, visible.data(), row_scenic.data());
+        column_pass(forest, thread_count, [this](IntType, IntType cell, Height col_visible, LineScore scenic) {
+            visible[cell] |= col_visible ? COL_VISIBLE : 0;
+            col_scenic[cell] = scenic;
+        });
+
+        for (auto flags : visible)
+            result.visible_count += flags != 0;
+        auto block_count = blocks_per_row * height;
+        for (IntType block_idx = 0; block_idx < block_count; ++block_idx)
+            block_tree[block_count + block_idx] = block_max(block_idx);
+        for (auto node = block_count - 1; node > 0; --node)
+            block_tree[node] = std::max(block_tree[2 * node], block_tree[2 * node + 1]);
+        result.max_scenic_score = block_count ? block_tree[1] : 0;
+    }
+
+    const Forest &get_forest() const { return forest; }
+    const Survey &get_result() const { return result; }
+
+    void set_height(IntType row, IntType col, Height tree)
+    {
+        if (row < 0 || row >= height || col < 0 || col >= width)
+            throw std::runtime_error("Tree position out of range");
+        if (tree > 9)
+            throw std::runtime_error("Invalid tree height");
+        if (forest.row(row)[col] == tree)
+            return;
+        forest.row(row)[col] = tree;
+
+        // Retract the visibility of every tree in the affected row and column, then re-sweep both lines
+        for (IntType col_idx = 0; col_idx < width; ++col_idx)
+            result.visible_count -= visible[row * width + col_idx] != 0;
+        for (IntType row_idx = 0; row_idx < height; ++row_idx)
+            result.visible_count -= row_idx != row && visible[row_idx * width + col] != 0;
+
+        line.resize(std::max(width, height));
+        line_visible.resize(line.size());
+        line_scenic.resize(line.size());
+
+        sweep_line(forest.row(row), width, line_visible.data(), line_scenic.data(), in_view);
+        for (IntType col_idx = 0; col_idx < width; ++col_idx) {
+            auto cell = row * width + col_idx;
+            visible[cell] = (visible[cell] & ~ROW_VISIBLE) | (line_visible[col_idx] ? ROW_VISIBLE : 0);
+            row_scenic[cell] = line_scenic[col_idx];
         }
 
-        Iterator &operator--()
-        {
-            index -= stride;
-            return *this;
+        for (IntType row_idx = 0; row_idx < height; ++row_idx)
+            line[row_idx] = forest.row(row_idx)[col];
+        sweep_line(line.data(), height, line_visible.data(), line_scenic.data(), in_view);
+        for (IntType row_idx = 0; row_idx < height; ++row_idx) {
+            auto cell = row_idx * width + col;
+            visible[cell] = (visible[cell] & ~COL_VISIBLE) | (line_visible[row_idx] ? COL_VISIBLE : 0);
+            col_scenic[cell] = line_scenic[row_idx];
         }
 
-        Iterator operator--(int)
-        {
-            Iterator tmp = *this;
-            --(*this);
-            return tmp;
+        for (IntType col_idx = 0; col_idx < width; ++col_idx)
+            result.visible_count += visible[row * width + col_idx] != 0;
+        for (IntType row_idx = 0; row_idx < height; ++row_idx)
+            result.visible_count += row_idx != row && visible[row_idx * width + col] != 0;
+
+        // Refresh the blocks along the row, and the block holding the column in every other row
+        for (IntType block_idx = 0; block_idx < blocks_per_row; ++block_idx)
+            refresh_block(row * blocks_per_row + block_idx);
+        for (IntType row_idx = 0; row_idx < height; ++row_idx) {
+            if (row_idx != row)
+                refresh_block(row_idx * blocks_per_row + col / BLOCK);
         }
+        result.max_scenic_score = block_tree[1];
+    }
 
-      private:
-        std::vector<IntType> *forest_arr;
-        IntType index;
-        IntType stride;
-    };
+  protected:
+    IntType block_max(IntType block_idx) const
+    {
+        auto row = block_idx / blocks_per_row;
+        auto col_begin = (block_idx % blocks_per_row) * BLOCK;
+        auto col_end = std::min(col_begin + BLOCK, width);
+        std::uint64_t best = 0;
+        for (auto cell = row * width + col_begin; cell < row * width + col_end; ++cell)
+            best = std::max(best, std::uint64_t(row_scenic[cell]) * col_scenic[cell]);
+        return static_cast<IntType>(best);
+    }
 
-    IntType get_edge_len() const { return edge_len; }
+    void refresh_block(IntType block_idx)
+    {
+        auto node = blocks_per_row * height + block_idx;
+        block_tree[node] = block_max(block_idx);
+        for (node /= 2; node > 0; node /= 2)
+            block_tree[node] = std::max(block_tree[2 * node], block_tree[2 * node + 1]);
+    }
 
-    Iterator row_itr(IntType row, IntType column) { return Iterator(&tree_heights, edge_len * row + column, 1); }
-    Iterator col_itr(IntType row, IntType column) { return Iterator(&tree_heights, edge_len * row + column, edge_len); }
-    Iterator row_begin(IntType idx) { return Iterator(&tree_heights, idx * edge_len, 1); }
-    Iterator row_end(IntType idx) { return Iterator(&tree_heights, (idx + 1) * edge_len, 1); }
-    Iterator col_begin(IntType idx) { return Iterator(&tree_heights, idx, edge_len); }
-    Iterator col_end(IntType idx) { return Iterator(&tree_heights, (edge_len * edge_len) + idx, edge_len); }
+    Forest forest;
+    const IntType width;
+    const IntType height;
+    const IntType blocks_per_row;
+    std::vector<Height> visible;
+    std::vector<LineScore> row_scenic;
+    std::vector<LineScore> col_scenic;
+    std::vector<IntType> block_tree;
+    Survey result;
 
-  protected:
-    const IntType edge_len;
-    std::vector<IntType> tree_heights;
+    // Scratch space for single line re-sweeps
+    std::vector<Height> line;
+    std::vector<Height> line_visible;
+    std::vector<LineScore> line_scenic;
+    std::vector<IntType> in_view;
 };
 
+// Time the survey of a random forest across a range of thread counts, then compare single tree updates against a full
+// recompute
+void benchmark(IntType width, IntType height)
+{
+    Forest forest(width, height);
+    std::mt19937 rng(8);
+    std::uniform_int_distribution<int> tree_dist(0, 9);
+    for (IntType row_idx = 0; row_idx < height; ++row_idx) {
+        auto *row = forest.row(row_idx);
+        for (IntType col_idx = 0; col_idx < width; ++col_idx)
+            row[col_idx] = static_cast<Height>(tree_dist(rng));
+    }
+
+    auto elapsed_ms = [](auto start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::cout << "Forest: " << width << "x" << height << std::endl;
+    double baseline_ms = 0;
+    for (IntType thread_count : {1, 2, 4, 8, 16}) {
+        auto start = std::chrono::steady_clock::now();
+        auto survey = survey_forest(forest, thread_count);
+        auto survey_ms = elapsed_ms(start);
+        if (thread_count == 1)
+            baseline_ms = survey_ms;
+        std::cout << "Threads: " << thread_count << ", Time: " << survey_ms << " ms, Speedup: "
+                  << baseline_ms / survey_ms << "x (visible " << survey.visible_count << ", max scenic "
+                  << survey.max_scenic_score << ")" << std::endl;
+    }
+
+    if (!width || !height)
+        return;
+    auto start = std::chrono::steady_clock::now();
+    ForestSurvey incremental(std::move(forest));
+    std::cout << "Incremental setup: " << elapsed_ms(start) << " ms" << std::endl;
+
+    static constexpr IntType UPDATES = 1000;
+    std::uniform_int_distribution<IntType> row_dist(0, height - 1);
+    std::uniform_int_distribution<IntType> col_dist(0, width - 1);
+    start = std::chrono::steady_clock::now();
+    for (IntType update = 0; update < UPDATES; ++update)
+        incremental.set_height(row_dist(rng), col_dist(rng), static_cast<Height>(tree_dist(rng)));
+    auto update_us = elapsed_ms(start) * 1000 / UPDATES;
+
+    start = std::chrono::steady_clock::now();
+    auto full = survey_forest(incremental.get_forest());
+    auto full_ms = elapsed_ms(start);
+    std::cout << "Update latency: " << update_us << " us, Full recompute: " << full_ms << " ms (incremental "
+              << incremental.get_result().visible_count << "/" << incremental.get_result().max_scenic_score
+              << ", full " << full.visible_count << "/" << full.max_scenic_score << ")" << std::endl;
+}
+
 int main(int argc, char *argv[])
 {
+    if (argc < 2)
+        return EXIT_FAILURE;
+    if (std::string_view(argv[1]) == "--bench") {
+        IntType width = argc > 2 ? std::atoll(argv[2]) : 8000;
+        IntType height = argc > 3 ? std::atoll(argv[3]) : width;
+        benchmark(width, height);
+        return EXIT_SUCCESS;
+    }
+
     // Create the forest
     std::ifstream input_data(argv[1], std::ios::in);
     if (!input_data)
@@ -102,50 +440,10 @@ int main(int argc, char *argv[])
         tree_rows.emplace_back(std::move(row));
     Forest forest(tree_rows);
 
-    auto rev = [](auto iter) { return std::make_reverse_iterator(iter); };
-
-    auto is_visible = [](auto start, auto max) -> bool {
-        for (auto pos = std::next(start); pos != max; pos++) {
-            if (*start <= *pos)
-                return false;
-        }
-        return true;
-    };
-
-    auto get_scenic_score = [](auto start, auto max) -> IntType {
-        if (start == max)
-            return 0;
-        IntType score = 0;
-        for (auto pos = std::next(start); pos != max; pos++) {
-            score++;
-            if (*pos >= *start)
-                return score;
-        }
-        return score;
-    };
-
-    IntType visible_count = 0;
-    IntType max_scenic_score = 0;
-    for (auto row_idx = 0; row_idx < forest.get_edge_len(); ++row_idx) {
-        for (auto col_idx = 0; col_idx < forest.get_edge_len(); ++col_idx) {
-            if (is_visible(forest.row_itr(row_idx, col_idx), forest.row_end(row_idx)) ||
-                is_visible(rev(++forest.row_itr(row_idx, col_idx)), rev(forest.row_begin(row_idx))) ||
-                is_visible(forest.col_itr(row_idx, col_idx), forest.col_end(col_idx)) ||
-                is_visible(rev(++forest.col_itr(row_idx, col_idx)), rev(forest.col_begin(col_idx)))) {
-                visible_count++;
-            }
-
-            IntType this_scenic_score =
-                get_scenic_score(forest.row_itr(row_idx, col_idx), forest.row_end(row_idx)) *
-                get_scenic_score(rev(++forest.row_itr(row_idx, col_idx)), rev(forest.row_begin(row_idx))) *
-                get_scenic_score(forest.col_itr(row_idx, col_idx), forest.col_end(col_idx)) *
-                get_scenic_score(rev(++forest.col_itr(row_idx, col_idx)), rev(forest.col_begin(col_idx)));
-            max_scenic_score = std::max(max_scenic_score, this_scenic_score);
-        }
-    }
-
-    std::cout << "Visible Count: " << visible_count << std::endl;
-    std::cout << "Max Scenic Score: " << max_scenic_score << std::endl;
+    auto thread_count = argc > 2 ? std::atoll(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+    auto survey = survey_forest(forest, thread_count);
+    std::cout << "Visible Count: " << survey.visible_count << std::endl;
+    std::cout << "Max Scenic Score: " << survey.max_scenic_score << std::endl;
 
     return EXIT_SUCCESS;
 }
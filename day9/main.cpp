@@ -1,14 +1,22 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
-#include <list>
-#include <regex>
-#include <set>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 using IntType = std::int64_t;
 
-using Coordinate = std::pair<IntType, IntType>;
-using Delta = std::pair<IntType, IntType>;
+using Coordinate = std::pair<std::int32_t, std::int32_t>;
+using Delta = std::pair<std::int32_t, std::int32_t>;
 
 Coordinate move(const Coordinate &c, const Delta &d) { return {c.first + d.first, c.second + d.second}; }
 Delta diff(const Coordinate &c2, const Coordinate &c1) { return {c2.first - c1.first, c2.second - c1.second}; }
@@ -29,69 +37,474 @@ Delta get_delta_from_text(char c)
     return {0, 0};
 }
 
-bool within_radius(const Coordinate &c1, const Coordinate &c2, IntType radius)
+bool within_radius(const Coordinate &c1, const Coordinate &c2, std::int32_t radius)
 {
     auto delta_x = std::abs(c2.first - c1.first);
     auto delta_y = std::abs(c2.second - c1.second);
     return delta_x <= radius && delta_y <= radius;
 }
 
-void move_rope(std::list<Coordinate> &knots, char head_dir)
+// Set of visited cells, stored as a sparse bitmap of 64x64 tiles so that memory follows the visited area rather than
+// its bounding box. Straight spans are marked a row word at a time.
+struct VisitedSet {
+    static constexpr std::int32_t TILE = 64;
+
+    // The tile cache points into this set's own map, so a copy would write into the original
+    VisitedSet() = default;
+    VisitedSet(const VisitedSet &) = delete;
+    VisitedSet &operator=(const VisitedSet &) = delete;
+
+    bool insert(const Coordinate &c)
+    {
+        auto &word = tile_at(tile_of(c.first), tile_of(c.second))[c.second - tile_of(c.second) * TILE];
+        auto mask = std::uint64_t(1) << (c.first - tile_of(c.first) * TILE);
+        if (word & mask)
+            return false;
+        word |= mask;
+        ++count;
+        return true;
+    }
+
+    // Mark count cells starting at start and stepping by the unit delta d
+    void insert_span(const Coordinate &start, const Delta &d, IntType count)
+    {
+        if (count <= 0)
+            return;
+        auto end = Coordinate(start.first + d.first * std::int32_t(count - 1),
+                              start.second + d.second * std::int32_t(count - 1));
+        if (d.second == 0)
+            insert_row_span(start.second, std::min(start.first, end.first), std::max(start.first, end.first));
+        else if (d.first == 0)
+            insert_col_span(start.first, std::min(start.second, end.second), std::max(start.second, end.second));
+        else {
+            for (auto c = start; count--; c = move(c, d))
+                insert(c);
+        }
+    }
+
+    IntType size() const { return count; }
+
+  protected:
+    using Tile = std::array<std::uint64_t, TILE>;
+
+    static std::int32_t tile_of(std::int32_t v) { return (v - (v < 0 ? TILE - 1 : 0)) / TILE; }
+
+    // Consecutive cells nearly always land in the same tile, so the last one looked up is kept on hand
+    Tile &tile_at(std::int32_t tile_x, std::int32_t tile_y)
+    {
+        auto key = (std::uint64_t(std::uint32_t(tile_x)) << 32) | std::uint32_t(tile_y);
+        if (!last_tile || key != last_key) {
+            last_tile = &tiles[key];
+            last_key = key;
+        }
+        return *last_tile;
+    }
+
+    void insert_row_span(std::int32_t y, std::int32_t x_min, std::int32_t x_max)
+    {
+        auto tile_y = tile_of(y);
+        auto row = y - tile_y * TILE;
+        for (auto tile_x = tile_of(x_min); tile_x <= tile_of(x_max); ++tile_x) {
+            auto lo = std::max(x_min - tile_x * TILE, 0);
+            auto hi = std::min(x_max - tile_x * TILE, TILE - 1);
+            auto mask = (~std::uint64_t(0) >> (TILE - 1 - hi)) & (~std::uint64_t(0) << lo);
+            auto &word = tile_at(tile_x, tile_y)[row];
+            count += std::popcount(mask & ~word);
+            word |= mask;
+        }
+    }
+
+    void insert_col_span(std::int32_t x, std::int32_t y_min, std::int32_t y_max)
+    {
+        auto tile_x = tile_of(x);
+        auto mask = std::uint64_t(1) << (x - tile_x * TILE);
+        for (auto tile_y = tile_of(y_min); tile_y <= tile_of(y_max); ++tile_y) {
+            auto &tile = tile_at(tile_x, tile_y);
+            auto lo = std::max(y_min - tile_y * TILE, 0);
+            auto hi = std::min(y_max - tile_y * TILE, TILE - 1);
+            for (auto row = lo; row <= hi; ++row) {
+                count += !(tile[row] & mask);
+                tile[row] |= mask;
+            }
+        }
+    }
+
+    std::unordered_map<std::uint64_t, Tile> tiles;
+    Tile *last_tile = nullptr;
+    std::uint64_t last_key = 0;
+    IntType count = 0;
+};
+
+// Knot i of a long rope follows exactly the path of the tail of an (i + 1) knot rope, so each knot records its own
+// visited cells and one simulation answers every shorter rope too. A knot that stays put stops the chain, since nothing
+// behind it can move either, and its visited set already holds its position.
+//
+// Returns true if every knot moved by exactly the head's delta. The rope is then straight behind the head, and every
+// further step in the same direction is the same rigid shift.
+bool move_rope(std::vector<Coordinate> &knots, std::vector<VisitedSet> &visited, const Delta &head_delta)
 {
     // First, move the head
-    auto knot_itr = knots.begin();
-    *knot_itr = move(*knot_itr, get_delta_from_text(head_dir));
+    knots[0] = move(knots[0], head_delta);
 
     // For each successive knot, see if it heeds to move. If not, we can stop. If so, figure out the required delta and
     // move it
-    auto clamp = [](IntType &val) -> IntType {
+    auto clamp = [](std::int32_t val) -> std::int32_t {
         if (std::abs(val) == 2)
             return val > 0 ? 1 : -1;
         return val;
     };
 
-    for (knot_itr++; knot_itr != knots.end(); knot_itr++) {
-        if (within_radius(*knot_itr, *std::prev(knot_itr), 1))
-            break;
+    bool translated = true;
+    for (std::size_t idx = 1; idx < knots.size(); ++idx) {
+        if (within_radius(knots[idx], knots[idx - 1], 1))
+            return false;
 
-        auto delta = diff(*std::prev(knot_itr), *knot_itr);
+        auto delta = diff(knots[idx - 1], knots[idx]);
         delta.first = clamp(delta.first);
         delta.second = clamp(delta.second);
-        *knot_itr = move(*knot_itr, delta);
+        knots[idx] = move(knots[idx], delta);
+        visited[idx].insert(knots[idx]);
+        translated = translated && delta == head_delta;
+    }
+    return translated;
+}
+
+// Shift a straightened rope by the remaining steps in one go, marking the line each knot traces as a span
+void fast_forward_rope(std::vector<Coordinate> &knots, std::vector<VisitedSet> &visited, const Delta &head_delta,
+                       IntType times)
+{
+    auto shift = Delta(head_delta.first * std::int32_t(times), head_delta.second * std::int32_t(times));
+    for (std::size_t idx = 0; idx < knots.size(); ++idx) {
+        if (idx)
+            visited[idx].insert_span(move(knots[idx], head_delta), head_delta, times);
+        knots[idx] = move(knots[idx], shift);
+    }
+}
+
+// Knot positions held as separate x and y columns and advanced a whole wave at a time. The head moves first, and at
+// wave t knot i applies head step t - i + 1, which only needs its predecessor's position from the previous wave, so
+// every knot in a wave updates independently with the same branchless clamp-sign arithmetic. Waves past the last head
+// step leave settled knots where they are, so flushing until nothing moves gives the same rope as the serial follow
+// chain.
+//
+// A knot can only move in a wave if its predecessor moved in the one before, so each wave only visits the knots just
+// behind the ones that moved last wave, from the tail end towards the head so that each one still sees its
+// predecessor's previous position and can be updated in place. Long stretches of consecutive knots go through the
+// vectorised follow.
+//
+// Once knots 1..r have all moved by exactly the head's delta, they keep doing so for as long as the head does, the same
+// rigid shift move_rope detects for the whole rope. That prefix is not stepped at all: it is shifted lazily by a
+// pending wave count and written out as spans when the head turns, so a straightened rope costs nothing per wave.
+struct WavefrontRope {
+    static constexpr std::size_t DENSE_RUN = 32;
+
+    WavefrontRope(std::size_t knot_count)
+        : x(knot_count, 0), y(knot_count, 0), next_x(knot_count, 0), next_y(knot_count, 0), moved(knot_count),
+          last_moved(knot_count), straight(knot_count, 0), joined_at(knot_count, 0)
+    {
+    }
+
+    // Run one wave, moving the head by head_delta and recording every knot that moves in its visited set. Returns true
+    // if the whole rope is now shifting rigidly with the head, so fast_forward can take over for the rest of the
+    // command.
+    bool step(const Delta &head_delta, std::vector<VisitedSet> &visited)
+    {
+        if (head_delta != rigid_delta) {
+            release_prefix(visited);
+            rigid_delta = head_delta;
+        }
+        x[0] += head_delta.first;
+        y[0] += head_delta.second;
+
+        // Both lists are in descending knot order. Knots that moved last wave are all behind the rigid prefix, so
+        // their successors are too, and the knot just behind the prefix comes last.
+        std::swap(moved, last_moved);
+        const auto count = moved_count;
+        moved_count = 0;
+        const auto tail = x.size() - 1;
+        for (std::size_t pos = 0; pos < count; ++pos) {
+            auto idx = last_moved[pos] + 1;
+            if (idx > tail)
+                continue;
+
+            // The list is strictly descending, so DENSE_RUN entries spanning DENSE_RUN knots are all consecutive
+            if (pos + DENSE_RUN <= count && last_moved[pos] - last_moved[pos + DENSE_RUN - 1] == DENSE_RUN - 1) {
+                auto end = pos + DENSE_RUN;
+                while (end < count && last_moved[end - 1] - last_moved[end] == 1)
+                    ++end;
+                auto first = last_moved[end - 1] + 1;
+                follow(first, idx);
+                for (auto knot_idx = idx; knot_idx >= first; --knot_idx)
+                    record(knot_idx, next_x[knot_idx], next_y[knot_idx], head_delta, visited);
+                pos = end - 1;
+            }
+            else
+                follow_one(idx, x[idx - 1], y[idx - 1], head_delta, visited);
+        }
+        if (head_delta != Delta{0, 0} && rigid < tail) {
+            auto lead = knot(rigid);
+            follow_one(rigid + 1, lead.first, lead.second, head_delta, visited);
+        }
+
+        // The prefix has moved one more step, and knots just behind it that kept pace with it join it
+        if (rigid)
+            ++pending;
+        while (head_delta != Delta{0, 0} && moved_count && moved[moved_count - 1] == rigid + 1 && straight[rigid + 1]) {
+            ++rigid;
+            --moved_count;
+            x[rigid] -= head_delta.first * std::int32_t(pending);
+            y[rigid] -= head_delta.second * std::int32_t(pending);
+            joined_at[rigid] = pending;
+        }
+        return rigid == tail;
+    }
+
+    // Shift a rigid rope by the remaining steps in one go
+    void fast_forward(const Delta &head_delta, IntType times)
+    {
+        x[0] += head_delta.first * std::int32_t(times);
+        y[0] += head_delta.second * std::int32_t(times);
+        pending += times;
+    }
+
+    // Let the knots still in flight catch up with the head
+    void flush(std::vector<VisitedSet> &visited)
+    {
+        while (moved_count || rigid)
+            step({0, 0}, visited);
+    }
+
+    Coordinate knot(std::size_t idx) const
+    {
+        if (idx && idx <= rigid)
+            return {x[idx] + rigid_delta.first * std::int32_t(pending),
+                    y[idx] + rigid_delta.second * std::int32_t(pending)};
+        return {x[idx], y[idx]};
+    }
+
+  protected:
+    static std::int32_t is_far(std::int32_t dx, std::int32_t dy) { return (dx > 1) | (dx < -1) | (dy > 1) | (dy < -1); }
+    static std::int32_t towards(std::int32_t d, std::int32_t far) { return ((d > 0) - (d < 0)) & -far; }
+
+    void record(std::size_t idx, std::int32_t new_x, std::int32_t new_y, const Delta &head_delta,
+                std::vector<VisitedSet> &visited)
+    {
+        auto delta = Delta(new_x - x[idx], new_y - y[idx]);
+        if (delta == Delta{0, 0})
+            return;
+        x[idx] = new_x;
+        y[idx] = new_y;
+        visited[idx].insert({new_x, new_y});
+        straight[idx] = delta == head_delta;
+        moved[moved_count++] = idx;
+    }
+
+    // Single knot version of follow, which only touches the knot if it has to move
+    void follow_one(std::size_t idx, std::int32_t lead_x, std::int32_t lead_y, const Delta &head_delta,
+                    std::vector<VisitedSet> &visited)
+    {
+        std::int32_t dx = lead_x - x[idx];
+        std::int32_t dy = lead_y - y[idx];
+        if (is_far(dx, dy))
+            record(idx, x[idx] + towards(dx, 1), y[idx] + towards(dy, 1), head_delta, visited);
+    }
+
+    // Next positions for knots [first, last], from the current positions of knots [first - 1, last]
+    void follow(std::size_t first, std::size_t last)
+    {
+        const auto *px = x.data();
+        const auto *py = y.data();
+        auto *nx = next_x.data();
+        auto *ny = next_y.data();
+        for (auto idx = first; idx <= last; ++idx) {
+            std::int32_t dx = px[idx - 1] - px[idx];
+            std::int32_t dy = py[idx - 1] - py[idx];
+            std::int32_t far = is_far(dx, dy);
+            nx[idx] = px[idx] + towards(dx, far);
+            ny[idx] = py[idx] + towards(dy, far);
+        }
+    }
+
+    // Write out the cells the rigid prefix passed through while it was shifted lazily. Every prefix knot moved in the
+    // last wave, so they go back on the moved list for the next one.
+    void release_prefix(std::vector<VisitedSet> &visited)
+    {
+        for (auto idx = rigid; idx >= 1; --idx) {
+            auto start = Coordinate(x[idx] + rigid_delta.first * std::int32_t(joined_at[idx] + 1),
+                                    y[idx] + rigid_delta.second * std::int32_t(joined_at[idx] + 1));
+            visited[idx].insert_span(start, rigid_delta, pending - joined_at[idx]);
+            auto position = knot(idx);
+            x[idx] = position.first;
+            y[idx] = position.second;
+            moved[moved_count++] = idx;
+        }
+        rigid = 0;
+        pending = 0;
+    }
+
+    std::vector<std::int32_t> x, y;
+    std::vector<std::int32_t> next_x, next_y;
+
+    // Knots that moved in the current and the previous wave, moved_count entries each, and whether each knot's last
+    // move matched the head's
+    std::vector<std::size_t> moved;
+    std::vector<std::size_t> last_moved;
+    std::size_t moved_count = 0;
+    std::vector<std::uint8_t> straight;
+
+    // Knots 1..rigid shift by rigid_delta every wave. Their stored positions leave out the last pending shifts, and
+    // joined_at holds the pending count when each one joined.
+    std::size_t rigid = 0;
+    Delta rigid_delta{0, 0};
+    IntType pending = 0;
+    std::vector<IntType> joined_at;
+};
+
+// Call fn(head_delta, times) for each command: a direction letter, a space and a step count
+template <typename Fn>
+void for_each_command(const std::string &commands, Fn &&fn)
+{
+    for (std::size_t pos = 0; pos < commands.size();) {
+        if (commands[pos] == '\n' || commands[pos] == '\r' || commands[pos] == ' ') {
+            ++pos;
+            continue;
+        }
+        auto head_delta = get_delta_from_text(commands[pos]);
+        for (pos += 2; pos < commands.size() && (commands[pos] < '0' || commands[pos] > '9'); ++pos)
+            ;
+        IntType times = 0;
+        for (; pos < commands.size() && commands[pos] >= '0' && commands[pos] <= '9'; ++pos)
+            times = times * 10 + (commands[pos] - '0');
+        for (; pos < commands.size() && commands[pos] != '\n'; ++pos)
+            ;
+        ++pos;
+        fn(head_delta, times);
     }
 }
 
-int main(int, char *argv[])
+std::vector<VisitedSet> make_knot_locations(std::size_t knot_count)
+{
+    std::vector<VisitedSet> knot_locations(knot_count);
+    for (auto &locations : knot_locations)
+        locations.insert(Coordinate{0, 0});
+    return knot_locations;
+}
+
+// Final knot positions and every knot's visited cells after a list of commands
+struct RopeRun {
+    std::vector<Coordinate> knots;
+    std::vector<VisitedSet> visited;
+};
+
+RopeRun run_serial(const std::string &commands, std::size_t knot_count)
 {
-    std::ifstream input_data(argv[1], std::ios::in);
+    RopeRun run{std::vector<Coordinate>(knot_count, Coordinate{0, 0}), make_knot_locations(knot_count)};
+    for_each_command(commands, [&](const Delta &head_delta, IntType times) {
+        while (times--) {
+            if (move_rope(run.knots, run.visited, head_delta) && times) {
+                fast_forward_rope(run.knots, run.visited, head_delta, times);
+                break;
+            }
+        }
+    });
+    return run;
+}
+
+RopeRun run_wavefront(const std::string &commands, std::size_t knot_count)
+{
+    WavefrontRope wavefront(knot_count);
+    RopeRun run{{}, make_knot_locations(knot_count)};
+    for_each_command(commands, [&](const Delta &head_delta, IntType times) {
+        while (times--) {
+            if (wavefront.step(head_delta, run.visited) && times) {
+                wavefront.fast_forward(head_delta, times);
+                break;
+            }
+        }
+    });
+    wavefront.flush(run.visited);
+    for (std::size_t idx = 0; idx < knot_count; ++idx)
+        run.knots.push_back(wavefront.knot(idx));
+    return run;
+}
+
+// Returns the first knot where the two runs disagree, if any
+std::optional<std::size_t> find_mismatch(const RopeRun &lhs, const RopeRun &rhs)
+{
+    for (std::size_t idx = 0; idx < lhs.knots.size(); ++idx)
+        if (lhs.knots[idx] != rhs.knots[idx] || lhs.visited[idx].size() != rhs.visited[idx].size())
+            return idx;
+    return {};
+}
+
+void benchmark(std::size_t knot_count, IntType move_count, IntType max_length)
+{
+    std::mt19937 rng(9);
+    std::uniform_int_distribution<int> dir_dist(0, 3);
+    std::uniform_int_distribution<IntType> length_dist(1, std::max<IntType>(1, max_length));
+    std::string commands;
+    for (IntType move = 0; move < move_count; ++move) {
+        commands += "UDLR"[dir_dist(rng)];
+        commands += ' ';
+        commands += std::to_string(length_dist(rng));
+        commands += '\n';
+    }
+
+    auto elapsed_ms = [](auto start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::cout << "Knots: " << knot_count << ", Moves: " << move_count << ", Length: 1-" << max_length << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    auto serial = run_serial(commands, knot_count);
+    auto serial_ms = elapsed_ms(start);
+    start = std::chrono::steady_clock::now();
+    auto wavefront = run_wavefront(commands, knot_count);
+    auto wavefront_ms = elapsed_ms(start);
+    std::cout << "Serial: " << serial_ms << " ms, Wavefront: " << wavefront_ms << " ms, Speedup: "
+              << serial_ms / wavefront_ms << "x (tail visited " << serial.visited.back().size() << ")" << std::endl;
+    if (find_mismatch(serial, wavefront))
+        std::cout << "Wavefront kernel disagrees with the serial follow chain!" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+        return EXIT_FAILURE;
+    if (std::string_view(argv[1]) == "--bench") {
+        std::size_t knot_count = argc > 2 ? std::atoll(argv[2]) : 10000;
+        if (knot_count < 2)
+            return EXIT_FAILURE;
+        benchmark(knot_count, argc > 3 ? std::atoll(argv[3]) : 100000, argc > 4 ? std::atoll(argv[4]) : 20);
+        return EXIT_SUCCESS;
+    }
+
+    std::ifstream input_data(argv[1], std::ios::in | std::ios::binary);
     if (!input_data)
         return EXIT_FAILURE;
+    std::size_t knot_count = argc > 2 ? std::atoll(argv[2]) : 10;
+    if (knot_count < 2)
+        return EXIT_FAILURE;
 
-    std::regex cmd_regex("([UDLR]+) ([0-9]+)$");
-    std::list<Coordinate> rope1, rope2;
-    std::set<Coordinate> rope1_tail_locations, rope2_tail_locations;
-
-    for (auto idx = 0; idx < 2; ++idx)
-        rope1.emplace_back(0, 0);
-    for (auto idx = 0; idx < 10; ++idx)
-        rope2.emplace_back(0, 0);
-
-    for (std::string cmd; std::getline(input_data, cmd);) {
-        std::smatch cmd_match;
-        if (std::regex_search(cmd, cmd_match, cmd_regex)) {
-            auto times = std::atoll(cmd_match.str(2).c_str());
-            while (times--) {
-                move_rope(rope1, cmd_match.str(1)[0]);
-                rope1_tail_locations.insert(*rope1.rbegin());
-
-                move_rope(rope2, cmd_match.str(1)[0]);
-                rope2_tail_locations.insert(*rope2.rbegin());
-            }
+    // The serial follow chain is the default. '--wavefront' uses the SoA kernel instead, and '--check' runs both and
+    // fails if they disagree on any knot.
+    std::string_view mode = argc > 3 ? argv[3] : "";
+
+    input_data.seekg(0, std::ios::end);
+    std::string commands(static_cast<std::size_t>(input_data.tellg()), '\0');
+    input_data.seekg(0, std::ios::beg);
+    input_data.read(commands.data(), static_cast<std::streamsize>(commands.size()));
+
+    auto run = mode == "--wavefront" ? run_wavefront(commands, knot_count) : run_serial(commands, knot_count);
+    if (mode == "--check") {
+        if (auto idx = find_mismatch(run, run_wavefront(commands, knot_count))) {
+            std::cout << "Wavefront kernel disagrees at knot " << *idx << std::endl;
+            return EXIT_FAILURE;
         }
     }
 
-    std::cout << "Num unique tail locations (2 knots): " << rope1_tail_locations.size() << std::endl;
-    std::cout << "Num unique tail locations (10 knots): " << rope2_tail_locations.size() << std::endl;
+    for (std::size_t idx = 1; idx < knot_count; ++idx)
+        std::cout << "Num unique tail locations (" << idx + 1 << " knots): " << run.visited[idx].size() << std::endl;
 
     return EXIT_SUCCESS;
 }